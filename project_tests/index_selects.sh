@@ -0,0 +1,71 @@
+#!/bin/bash
+# Runs the same selects over copies of one column that are unindexed, or
+# have a B+tree, CSS-tree, sorted or cracked index, before and after
+# inserts, and checks every index returns the same positions as the scan.
+#
+# Usage: index_selects.sh <dir with server and client>
+BIN=$(cd "${1:-.}" && pwd)
+WORK=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null; rm -rf "$WORK"' EXIT
+cd "$WORK"
+
+"$BIN/server" > server.log 2>&1 &
+SERVER=$!
+sleep 0.5
+
+COLS="a b c d e"
+{
+    echo "db9.t.a,db9.t.b,db9.t.c,db9.t.d,db9.t.e"
+    awk 'BEGIN { srand(165); for (i = 0; i < 20000; i++) {
+        v = int(rand() * 2000) - 1000; print v "," v "," v "," v "," v } }'
+} > rows.csv
+
+"$BIN/client" > /dev/null <<DSL
+create(db,"db9")
+create(tbl,"t",db9,5)
+create(col,"a",db9.t,unsorted)
+create(col,"b",db9.t,unsorted)
+create(col,"c",db9.t,unsorted)
+create(col,"d",db9.t,unsorted)
+create(col,"e",db9.t,unsorted)
+create(idx,db9.t.b,btree)
+create(idx,db9.t.c,csstree)
+create(idx,db9.t.d,sorted)
+create(idx,db9.t.e,cracked)
+load("$WORK/rows.csv")
+DSL
+
+RANGES="null,null -1000,1000 0,1 -5,5 17,17 20,10 999,2000 -2000,-999 -300,450"
+failed=0
+
+check_ranges() {
+    for range in $RANGES; do
+        expected=""
+        for col in $COLS; do
+            got=$(printf 'p=select(db9.t.%s,%s)\ntuple(p)\n' $col $range |
+                "$BIN/client" 2>&1 | sort -n | md5sum)
+            if [ -z "$expected" ]; then
+                expected=$got
+            elif [ "$got" != "$expected" ]; then
+                echo "FAIL: select($col,$range) $1 differs from the scan"
+                failed=1
+            fi
+        done
+    done
+}
+
+check_ranges "after load"
+
+# Inserts after every index is built, including duplicates and new extremes
+for v in 0 0 17 -1000 999 1500 -1500 5 5 5; do
+    echo "relational_insert(db9.t,$v,$v,$v,$v,$v)"
+done | "$BIN/client" > /dev/null
+check_ranges "after inserts"
+
+echo shutdown | "$BIN/client" > /dev/null
+wait $SERVER
+
+if [ $failed -eq 0 ]; then
+    echo "index selects: ok"
+fi
+exit $failed
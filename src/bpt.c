@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include "bpt.h"
 #include "helpers.h"
 
@@ -107,12 +108,9 @@ node* find_leaf(node* root, int key) {
 		return c;
 	}
 	while (!c->is_leaf) {
+		// Child i holds keys in [keys[i-1], keys[i]]. Don't skip past equal
+		// separators: the child before them can still hold keys above key.
 		i = binary_search(c->keys, key, 0, c->num_keys);
-		if (i != 0) {
-			while(c->keys[i] != key && i < c->num_keys-1 && c->keys[i] == c->keys[i+1]) {
-				i++;
-			}
-		}
 
 		c = (node *)c->pointers[i];
 	}
@@ -139,99 +137,34 @@ int* find_in_bptree(node* root, int key) {
 	}
 }
 
-status find_range_bpt_leading(column* col, result* r, int lower, int upper) {
-	log_info("Searching in BPT on leading column\n");
-	status s;
-
-	int* payload = (int*)r->payload;
-	int* start_addr = col->data;
-	int i, j, k;
-	int* ptr;
-
-	node* root = (node*)col->index->index;
-	node* start = find_leaf(root, lower);
-	node* end = find_leaf(root, upper);
-
-	if (start == NULL || end == NULL) {
-		s.code = ERROR;
-		s.error_message = "Can't find val\n";
-		return s;
-	}
-
-	i = binary_search(start->keys, lower, 0, start->num_keys);
-	j = binary_search(end->keys, upper, 0, end->num_keys);
-	
-	while(i == start->num_keys) {
-		start = start->pointers[order - 1];
-		if (!start) break;
-		i = binary_search(start->keys, lower, 0, start->num_keys);
-	}
-
-	while(j == end->num_keys) {
-		end = end->pointers[order - 1];
-		if (!end) break;
-		j = binary_search(end->keys, upper, 0, end->num_keys);
-	}
-
-	if (start == NULL || end == NULL) {
-		s.code = ERROR;
-		s.error_message = "Can't find val\n";
-		return s;
-	}
-
-	for(k = 0, ptr = (int*)start->pointers[i]; ptr < (int*)end->pointers[j]; k++, ptr++) {
-		payload[k] = ptr - start_addr;
-	}
-
-	r->type = INT;
-	r->num_tuples = k;
-
-	s.code = OK;
-	return s;
-}
-
 status find_range_bpt(column* col, result* r, int lower, int upper) {
 	log_info("Searching in BPT\n");
-
-	if (col->leading) {
-		return find_range_bpt_leading(col, r, lower, upper);
-	}
-
 	status s;
 
 	int* payload = (int*)r->payload;
 	int* start_addr = col->data;
-	int i, j;
-
-	node* root = (node*)col->index->index;
-	node* n = find_leaf(root, lower);
-	if (n == NULL) {
-		s.code = ERROR;
-		s.error_message = "Can't find val\n";
-		return s;
-	}
-
-	i = binary_search(n->keys, lower, 0, n->num_keys);
-	while(i == n->num_keys) {
-		n = n->pointers[order - 1];
-		if (!n) break;
-		i = binary_search(n->keys, lower, 0, n->num_keys);
-	}
+	node* n = (node*)col->index->index;
+	int i = 0;
 
-	if (n == NULL) {
-		s.code = ERROR;
-		s.error_message = "Can't find val\n";
-		return s;
+	// Descend on lower - 1 so we land left of every duplicate of lower,
+	// then walk the leaves while their keys are below upper.
+	if (lower == INT_MIN) {
+		while (n && !n->is_leaf) {
+			n = (node*)n->pointers[0];
+		}
+	} else if (n) {
+		n = find_leaf(n, lower - 1);
+		i = binary_search(n->keys, lower - 1, 0, n->num_keys);
 	}
 
-	j = 0;
-	while(n != NULL) {
-		for(; i < n->num_keys && n->keys[i] <= upper; i++) {
-			payload[j] = (int*)n->pointers[i] - start_addr;
-			j++;
+	size_t j = 0;
+	for (; n; n = (node*)n->pointers[order - 1], i = 0) {
+		for (; i < n->num_keys && n->keys[i] < upper; i++) {
+			payload[j++] = (int*)n->pointers[i] - start_addr;
+		}
+		if (i < n->num_keys) {
+			break;
 		}
-		n = n->pointers[order - 1];
-		i = 0;
 	}
 	r->type = INT;
 	r->num_tuples = j;
@@ -251,12 +184,17 @@ status make_node(node** new_node) {
 	}
 	(*new_node)->keys = malloc( (order - 1) * sizeof(int) );
 	if ((*new_node)->keys == NULL) {
+		free(*new_node);
+		*new_node = NULL;
 		s.code = ERROR;
 		s.error_message = "Error creating new node keys array\n";
 		return s;
 	}
 	(*new_node)->pointers = malloc( order * sizeof(void *) );
 	if ((*new_node)->pointers == NULL) {
+		free((*new_node)->keys);
+		free(*new_node);
+		*new_node = NULL;
 		s.code = ERROR;
 		s.error_message = "Error creating new node pointers array\n";
 		return s;
@@ -405,8 +343,9 @@ status insert_into_leaf(node* leaf, int key, int* pointer) {
 	status s;
 	int i, insertion_point;
 
+	// After any equal keys, so duplicates stay in position order
 	insertion_point = 0;
-	while (insertion_point < leaf->num_keys && leaf->keys[insertion_point] < key)
+	while (insertion_point < leaf->num_keys && leaf->keys[insertion_point] <= key)
 		insertion_point++;
 
 	for (i = leaf->num_keys; i > insertion_point; i--) {
@@ -451,7 +390,7 @@ status insert_into_leaf_after_splitting(node** root, node* leaf, int key, int* p
 
 	// Figure out insertion index and copy into temp arrays valid ordering
 	insertion_index = 0;
-	while (insertion_index < order - 1 && leaf->keys[insertion_index] < key)
+	while (insertion_index < order - 1 && leaf->keys[insertion_index] <= key)
 		insertion_index++;
 
 	for (i = 0, j = 0; i < leaf->num_keys; i++, j++) {
@@ -561,17 +500,250 @@ status insert_bpt(node** root, int key, int* value) {
 	return s;
 }
 
+// Splits count entries evenly over the fewest nodes holding at most fill
+// entries each. Returns the node count; node i gets entries [first(i), first(i+1)).
+size_t plan_nodes(size_t count, size_t fill) {
+	return (count + fill - 1) / fill;
+}
+
+size_t node_start(size_t count, size_t num_nodes, size_t i) {
+	return (count / num_nodes) * i + (i < count % num_nodes ? i : count % num_nodes);
+}
+
+typedef struct leaf_args {
+	node** leaves;
+	kv_pair* pairs;
+	size_t num_pairs;
+	size_t num_leaves;
+	size_t first;
+	size_t last;
+	int* base;
+	status s;
+} leaf_args;
+
+// Packs leaves [first, last) from their slice of the sorted pairs.
+void* pack_leaves_worker(void* arg) {
+	leaf_args* args = (leaf_args*)arg;
+	args->s.code = OK;
+
+	for (size_t l = args->first; l < args->last; l++) {
+		node* leaf = NULL;
+		args->s = make_leaf(&leaf);
+		if (args->s.code != OK) {
+			return NULL;
+		}
+
+		size_t start = node_start(args->num_pairs, args->num_leaves, l);
+		size_t end = node_start(args->num_pairs, args->num_leaves, l + 1);
+		for (size_t i = start; i < end; i++) {
+			leaf->keys[i - start] = args->pairs[i].key;
+			leaf->pointers[i - start] = args->base + args->pairs[i].pos;
+		}
+		leaf->num_keys = end - start;
+		leaf->pointers[order - 1] = NULL;
+		args->leaves[l] = leaf;
+	}
+
+	return NULL;
+}
+
+// Frees the subtrees of a level under construction, then the level array.
+void free_bpt_level(node** level, size_t num_nodes) {
+	for (size_t i = 0; i < num_nodes; i++) {
+		free_bpt(level[i]);
+	}
+	free(level);
+}
+
+// Builds a tree bottom-up from pairs sorted by key: leaves are packed to
+// BPT_FILL_FACTOR and chained, then each inner level is packed over the one
+// below until a single root remains. Leaf pointers point to base + pos.
+status bulk_load_bpt(node** root, kv_pair* pairs, size_t num_pairs, int* base) {
+	status s;
+
+	*root = NULL;
+	if (num_pairs == 0) {
+		s.code = OK;
+		return s;
+	}
+
+	size_t leaf_fill = (size_t)((order - 1) * BPT_FILL_FACTOR);
+	size_t inner_fill = (size_t)(order * BPT_FILL_FACTOR);
+	leaf_fill = leaf_fill < 1 ? 1 : leaf_fill;
+	inner_fill = inner_fill < 2 ? 2 : inner_fill;
+
+	size_t num_nodes = plan_nodes(num_pairs, leaf_fill);
+	node** level = calloc(num_nodes, sizeof(node*));
+	int* mins = malloc(num_nodes * sizeof(int));
+	if (!level || !mins) {
+		free(level);
+		free(mins);
+		s.code = ERROR;
+		s.error_message = "Error allocating bulk load levels\n";
+		return s;
+	}
+
+	// Leaves are independent, so large trees pack them across threads
+	size_t num_threads = num_pairs >= PARALLEL_SORT_THRESHOLD ? DEFAULT_NUM_THREADS : 1;
+	if (num_threads > num_nodes) {
+		num_threads = num_nodes;
+	}
+	pthread_t threads[num_threads];
+	leaf_args args[num_threads];
+	bool started[num_threads];
+
+	for (size_t t = 0; t < num_threads; t++) {
+		args[t].leaves = level;
+		args[t].pairs = pairs;
+		args[t].num_pairs = num_pairs;
+		args[t].num_leaves = num_nodes;
+		args[t].first = node_start(num_nodes, num_threads, t);
+		args[t].last = node_start(num_nodes, num_threads, t + 1);
+		args[t].base = base;
+	}
+
+	// This thread packs the first share, and any share we can't get a thread for
+	for (size_t t = 1; t < num_threads; t++) {
+		started[t] = pthread_create(&threads[t], NULL, pack_leaves_worker, &args[t]) == 0;
+	}
+	started[0] = false;
+	for (size_t t = 0; t < num_threads; t++) {
+		if (!started[t]) {
+			pack_leaves_worker(&args[t]);
+		}
+	}
+
+	s.code = OK;
+	for (size_t t = 0; t < num_threads; t++) {
+		if (started[t]) {
+			pthread_join(threads[t], NULL);
+		}
+		if (args[t].s.code != OK) {
+			s = args[t].s;
+		}
+	}
+	if (s.code != OK) {
+		free_bpt_level(level, num_nodes);
+		free(mins);
+		return s;
+	}
+
+	for (size_t l = 0; l < num_nodes; l++) {
+		if (l + 1 < num_nodes) {
+			level[l]->pointers[order - 1] = level[l + 1];
+		}
+		mins[l] = level[l]->keys[0];
+	}
+
+	while (num_nodes > 1) {
+		size_t num_parents = plan_nodes(num_nodes, inner_fill);
+		node** parents = calloc(num_parents, sizeof(node*));
+		int* parent_mins = malloc(num_parents * sizeof(int));
+		if (!parents || !parent_mins) {
+			free(parents);
+			free(parent_mins);
+			free_bpt_level(level, num_nodes);
+			free(mins);
+			s.code = ERROR;
+			s.error_message = "Error allocating bulk load levels\n";
+			return s;
+		}
+
+		for (size_t p = 0; p < num_parents; p++) {
+			s = make_node(&parents[p]);
+			if (s.code != OK) {
+				// Free the new parents alone; their children go with level
+				for (size_t q = 0; q < p; q++) {
+					free_node(parents[q]);
+				}
+				free(parents);
+				free_bpt_level(level, num_nodes);
+				free(parent_mins);
+				free(mins);
+				return s;
+			}
+
+			size_t start = node_start(num_nodes, num_parents, p);
+			size_t end = node_start(num_nodes, num_parents, p + 1);
+			for (size_t c = start; c < end; c++) {
+				parents[p]->pointers[c - start] = level[c];
+				if (c > start) {
+					parents[p]->keys[c - start - 1] = mins[c];
+				}
+				level[c]->parent = parents[p];
+			}
+			parents[p]->num_keys = end - start - 1;
+			parent_mins[p] = mins[start];
+		}
+
+		free(level);
+		free(mins);
+		level = parents;
+		mins = parent_mins;
+		num_nodes = num_parents;
+	}
+
+	*root = level[0];
+	(*root)->parent = NULL;
+	free(level);
+	free(mins);
+
+	s.code = OK;
+	return s;
+}
+
+// Frees one node, leaving its children alone.
+void free_node(node* n) {
+	free(n->keys);
+	free(n->pointers);
+	free(n);
+}
+
+void free_bpt(node* root) {
+	if (root == NULL) {
+		return;
+	}
+	if (!root->is_leaf) {
+		for (int i = 0; i <= root->num_keys; i++) {
+			free_bpt(root->pointers[i]);
+		}
+	}
+	free_node(root);
+}
+
+// Rebases every leaf pointer after the column data moved from old_base to
+// new_base.
+status update_bpt_pointers(node* root, int* old_base, int* new_base) {
+	status s;
+
+	node* c = root;
+	while (c && !c->is_leaf) {
+		c = (node*)c->pointers[0];
+	}
+	for (; c; c = (node*)c->pointers[order - 1]) {
+		for (int i = 0; i < c->num_keys; i++) {
+			c->pointers[i] = new_base + ((int*)c->pointers[i] - old_base);
+		}
+	}
+
+	s.code = OK;
+	return s;
+}
+
 status build_secondary_bpt_index(column *col) {
     status s;
 
-    node** root = (node**) (&(col->index->index));
-    for (size_t i = 0; i < col->data_count; i++) {
-        s = insert_bpt(root, col->data[i], &(col->data[i]));
-        if (s.code != OK) {
-            return s;
-        }
+    free_bpt((node*)col->index->index);
+    col->index->index = NULL;
+
+    kv_pair* pairs = sort_pairs(col->data, NULL, col->data_count);
+    if (!pairs) {
+        s.code = ERROR;
+        s.error_message = "Error sorting column for index\n";
+        return s;
     }
 
-    s.code = OK;
+    s = bulk_load_bpt((node**)(&(col->index->index)), pairs, col->data_count, col->data);
+    free(pairs);
     return s;
-}
\ No newline at end of file
+}
@@ -12,6 +12,9 @@
  * For more information on unix sockets, refer to:
  * http://beej.us/guide/bgipc/output/html/multipage/unixsock.html
  **/
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -27,6 +30,16 @@
 
 #define DEFAULT_STDIN_BUFFER_SIZE 1024
 
+// Rows sent to the server per frame when the client loads a file itself
+#define LOAD_BATCH_ROWS 4096
+
+// Queries a script may send ahead of their replies. The queries in flight
+// fit in the socket's buffer, so sending never blocks on a server that is
+// itself waiting for its replies to be read.
+#ifndef PIPELINE_WINDOW
+#define PIPELINE_WINDOW 32
+#endif
+
 /**
  * connect_client()
  *
@@ -58,6 +71,265 @@ int connect_client() {
     return client_socket;
 }
 
+/**
+ * send_query(client_socket, send_message)
+ *
+ * Sends the message header and its payload (the query) to the server.
+ * Exits if the server cannot be reached.
+ **/
+void send_query(int client_socket, message* send_message) {
+    // The header tells the server the payload size
+    if (send_frame(client_socket, send_message, send_message->payload) == -1) {
+        log_err("Failed to send query.\n");
+        exit(1);
+    }
+}
+
+/**
+ * reserve_payload(payload, capacity, n)
+ *
+ * Grows the buffer *@payload to hold at least @n bytes.
+ **/
+bool reserve_payload(char** payload, size_t* capacity, size_t n) {
+    if (n <= *capacity) {
+        return true;
+    }
+    char* grown = realloc(*payload, n);
+    if (!grown) {
+        return false;
+    }
+    *payload = grown;
+    *capacity = n;
+    return true;
+}
+
+/**
+ * frame_size(frame, types)
+ *
+ * The bytes a frame of @frame->num_rows rows takes when column j holds
+ * values of @types[j].
+ **/
+size_t frame_size(message* frame, DataType* types) {
+    size_t row_width = 0;
+    for(size_t j = 0; j < frame->num_cols; j++) {
+        row_width += type_width(types[j]);
+    }
+    return frame->num_rows * row_width;
+}
+
+/**
+ * print_rows(frame, types, payload)
+ *
+ * Prints the rows of a frame, whose @payload holds one column after
+ * another, column j of values of @types[j].
+ **/
+void print_rows(message* frame, DataType* types, char* payload) {
+    size_t num_rows = frame->num_rows;
+    size_t num_cols = frame->num_cols;
+
+    // Where each column starts in the frame
+    char* cols[num_cols];
+    for(size_t j = 0; j < num_cols; j++) {
+        cols[j] = payload;
+        payload += num_rows * type_width(types[j]);
+    }
+
+    for(size_t i = 0; i < num_rows; i++) {
+        for(size_t j = 0; j < num_cols; j++) {
+            if (types[j] == INT) {
+                printf("%d", ((int*)cols[j])[i]);
+            } else if (types[j] == LONG) {
+                printf("%ld", ((long*)cols[j])[i]);
+            } else if (types[j] == LONG_DOUBLE) {
+                printf("%.12Lf", ((long double*)cols[j])[i]);
+            }
+            if (j != num_cols -1) {
+                printf(",");
+            }
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * receive_reply(client_socket, recv_message, have_header, request_id,
+ *     payload, capacity)
+ *
+ * Receives the reply to query @request_id and prints it out, reading the
+ * header into @recv_message unless @have_header says it is already there.
+ * Responses are received into *@payload, grown as needed. Returns false
+ * once the server has shut down.
+ **/
+bool receive_reply(int client_socket, message* recv_message, bool have_header,
+        size_t request_id, char** payload, size_t* capacity) {
+    if (!have_header && recv_header(client_socket, recv_message) == -1) {
+        log_info("Server closed connection\n");
+        exit(1);
+    }
+    if (recv_message->request_id != request_id) {
+        log_err("Reply to query %zu where %zu was expected.\n",
+            recv_message->request_id, request_id);
+        exit(1);
+    }
+
+    if (recv_message->status == OK_WAIT_FOR_RESPONSE && recv_message->type != CHAR) {
+        // The type of each column comes first
+        size_t num_cols = recv_message->num_cols;
+        DataType* types = malloc(num_cols * sizeof(DataType));
+        if (num_cols == 0 || !types ||
+                (size_t) recv_message->length != num_cols * sizeof(uint32_t) ||
+                !reserve_payload(payload, capacity, recv_message->length) ||
+                read_fully(client_socket, *payload, recv_message->length) == -1) {
+            log_err("Failed to receive message.");
+            exit(1);
+        }
+        for(size_t j = 0; j < num_cols; j++) {
+            uint32_t type;
+            memcpy(&type, *payload + j * sizeof(uint32_t), sizeof(uint32_t));
+            types[j] = (DataType) type;
+        }
+
+        // Rows arrive in frames, each printed before the next is read
+        size_t rows_left = recv_message->num_rows;
+        while (rows_left > 0) {
+            message frame;
+            if (recv_header(client_socket, &frame) == -1 ||
+                    frame.num_rows == 0 || frame.num_rows > rows_left ||
+                    frame.num_cols != num_cols ||
+                    (size_t) frame.length != frame_size(&frame, types) ||
+                    !reserve_payload(payload, capacity, frame.length) ||
+                    read_fully(client_socket, *payload, frame.length) == -1) {
+                log_err("Failed to receive message.");
+                exit(1);
+            }
+            print_rows(&frame, types, *payload);
+            rows_left -= frame.num_rows;
+        }
+        free(types);
+    } else if (recv_message->status == OK_WAIT_FOR_RESPONSE &&
+            (int) recv_message->length > 0) {
+        // Receive the payload and print it out
+        size_t num_bytes = recv_message->length;
+        if (!reserve_payload(payload, capacity, num_bytes + 1) ||
+                read_fully(client_socket, *payload, num_bytes) == -1) {
+            log_err("Failed to receive message.");
+            exit(1);
+        }
+        (*payload)[num_bytes] = '\0';
+        log_info("%s", *payload);
+    } else if (recv_message->status == SHUTDOWN_CLIENT) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * send_batch(client_socket, send_message, batch, num_rows, num_cols)
+ *
+ * Sends the first @num_rows rows of each column of @batch, which holds
+ * LOAD_BATCH_ROWS values per column, to the server as one frame.
+ **/
+void send_batch(int client_socket, message* send_message, int* batch,
+        size_t num_rows, size_t num_cols) {
+    // Close up the columns so the frame is one run of values
+    for(size_t j = 1; j < num_cols; j++) {
+        memmove(batch + j * num_rows, batch + j * LOAD_BATCH_ROWS, num_rows * sizeof(int));
+    }
+
+    send_message->status = LOAD_BATCH;
+    send_message->num_rows = num_rows;
+    send_message->num_cols = num_cols;
+    send_message->length = num_rows * num_cols * sizeof(int);
+    send_message->payload = (char*) batch;
+    send_query(client_socket, send_message);
+}
+
+/**
+ * send_load_file(client_socket, send_message, path)
+ *
+ * Sends the rows of the file at @path to the server in binary column
+ * batches, for servers that cannot read it themselves. Returns false if
+ * the file cannot be opened.
+ **/
+bool send_load_file(int client_socket, message* send_message, const char* path) {
+    // Open file for bulk load
+    FILE *fd = fopen(path, "r");
+
+    if (fd == NULL) {
+        log_err("Failed to open file\n");
+        return false;
+    }
+
+    char * line = NULL;
+    size_t line_len = 0;
+    ssize_t read = getline(&line, &line_len, fd);
+    if (read == -1) {
+        log_err("Failed to read file\n");
+        fclose(fd);
+        free(line);
+        return false;
+    }
+
+    // Send a request to load data, with the first line of the file, which
+    // tells the column metadata
+    send_message->status = LOAD_REQUEST;
+    send_message->length = read;
+    send_message->payload = line;
+    send_query(client_socket, send_message);
+
+    size_t num_cols = 1;
+    for(char* c = line; *c; c++) {
+        num_cols += *c == ',';
+    }
+    int* batch = malloc(LOAD_BATCH_ROWS * num_cols * sizeof(int));
+    size_t num_rows = 0;
+    bool malformed = batch == NULL;
+
+    // Parse the rows into batches of columns
+    while(!malformed && (read = getline(&line, &line_len, fd)) != -1) {
+        if (line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+
+        char* p = line;
+        for(size_t j = 0; j < num_cols && !malformed; j++) {
+            char* end;
+            errno = 0;
+            long val = strtol(p, &end, 10);
+            char sep = j + 1 < num_cols ? ',' : '\n';
+            malformed = end == p || errno != 0 || val < INT_MIN || val > INT_MAX ||
+                (*end != sep && (sep == ',' || (*end != '\r' && *end != '\0')));
+            batch[j * LOAD_BATCH_ROWS + num_rows] = (int) val;
+            p = end + 1;
+        }
+
+        if (!malformed && ++num_rows == LOAD_BATCH_ROWS) {
+            send_batch(client_socket, send_message, batch, num_rows, num_cols);
+            num_rows = 0;
+        }
+    }
+
+    if (malformed) {
+        // Have the server drop the batches sent so far
+        log_err("Malformed row: %s", line);
+        send_message->status = INCORRECT_FORMAT;
+    } else {
+        if (num_rows > 0) {
+            send_batch(client_socket, send_message, batch, num_rows, num_cols);
+        }
+        send_message->status = LOAD_DONE;
+    }
+
+    fclose(fd);
+    free(line);
+    free(batch);
+
+    send_message->length = 0;
+    send_query(client_socket, send_message);
+
+    return true;
+}
+
 int main(void)
 {
     int client_socket = connect_client();
@@ -71,12 +343,23 @@ int main(void)
     // Always output an interactive marker at the start of each command if the
     // input is from stdin. Do not output if piped in from file or from other fd
     char* prefix = "";
+    size_t window = PIPELINE_WINDOW;
     if (isatty(fileno(stdin))) {
         prefix = "db_client > ";
+        window = 1;
     }
 
     char *output_str = NULL;
-    int len = 0;
+
+    // Reused for every response payload
+    char* payload = NULL;
+    size_t payload_capacity = 0;
+
+    // Queries are numbered as they are sent; replies come back in order,
+    // so the oldest unanswered query is always the next one replied to
+    size_t next_id = 0;
+    size_t replied_id = 0;
+    bool running = true;
 
     // Continuously loop and wait for input. At each iteration:
     // 1. output interactive marker
@@ -84,8 +367,8 @@ int main(void)
     char read_buffer[DEFAULT_STDIN_BUFFER_SIZE];
     send_message.payload = read_buffer;
 
-    while (printf("%s", prefix), output_str = fgets(read_buffer,
-           DEFAULT_STDIN_BUFFER_SIZE, stdin), !feof(stdin)) {
+    while (running && (printf("%s", prefix), output_str = fgets(read_buffer,
+           DEFAULT_STDIN_BUFFER_SIZE, stdin), !feof(stdin))) {
         if (output_str == NULL) {
             log_err("fgets failed.\n");
             break;
@@ -96,159 +379,87 @@ int main(void)
         // Otherwise, convert to message and send the message and the
         // payload directly to the server.
         send_message.length = strlen(read_buffer);
-        if (send_message.length > 1) {
-            if (strncmp("load", read_buffer, 4) == 0) {
-                // Create a working copy, +1 for '\0'
-                char* str_cpy = malloc(strlen(read_buffer) + 1);
-                strncpy(str_cpy, read_buffer, strlen(read_buffer) + 1);
-
-                // This gives us everything inside the parens
-                strtok(str_cpy, "\"");
-                char* path = strtok(NULL, "\"");
-                
-                // Open file for bulk load
-                FILE *fd = fopen(path, "r");
-
-                if (fd == NULL) {
-                    log_err("Failed to open file\n");
-                    continue;
-                }
-
-                char * line = NULL;
-                size_t line_len = 0;
-                ssize_t read = getline(&line, &line_len, fd);
-
-                send_message.status = LOAD_REQUEST;
-                send_message.length = line_len;
-                
-                // Send a request to load data
-                if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                    log_err("Failed to send message header.\n");
-                    exit(1);
-                }
-
-                send_message.payload = line;
-
-                // Send the first line of the file, which tells the column metadata
-                if (send(client_socket, send_message.payload, send_message.length, 0) == -1) {
-                    log_err("Failed to send message header.\n");
-                    exit(1);
-                }
-
-                // Send the data to server
-                while((read = getline(&line, &line_len, fd)) != -1) {
-                    send_message.length = line_len;
-                    send_message.status = OK_WAIT_FOR_RESPONSE;
-
-                    // Send length of next line
-                    if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                        log_err("Failed to send message header.\n");
-                        exit(1);
-                    }
-
-                    send_message.payload = line;
-                    if (send(client_socket, send_message.payload, send_message.length, 0) == -1) {
-                        log_err("Failed to send query payload.\n");
-                        exit(1);
-                    }
-                }
-
-                fclose(fd);
-
-                send_message.status = LOAD_DONE;
-                if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                    log_err("Failed to send query payload.\n");
-                    exit(1);
-                }
-
-                send_message.payload = read_buffer;
+        if (send_message.length <= 1) {
+            continue;
+        }
 
-            } else {
-                // Send the message_header, which tells server payload size
-                if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                    log_err("Failed to send message header.");
-                    exit(1);
-                }
+        // Loads and shutdown wait for every query before them
+        bool sync = strncmp("load", read_buffer, 4) == 0 ||
+            strncmp("shutdown", read_buffer, 8) == 0;
+        while (sync && running && replied_id < next_id) {
+            running = receive_reply(client_socket, &recv_message, false, replied_id++,
+                &payload, &payload_capacity);
+        }
+        if (!running) {
+            break;
+        }
 
-                // Send the payload (query) to server
-                if (send(client_socket, send_message.payload, send_message.length, 0) == -1) {
-                    log_err("Failed to send query payload.");
-                    exit(1);
-                }
+        // The reply header, when it has already been read
+        bool have_reply = false;
+        send_message.request_id = next_id;
+
+        if (strncmp("load", read_buffer, 4) == 0) {
+            // Create a working copy, +1 for '\0'
+            char* str_cpy = malloc(strlen(read_buffer) + 1);
+            strncpy(str_cpy, read_buffer, strlen(read_buffer) + 1);
+
+            // This gives us everything inside the parens
+            strtok(str_cpy, "\"");
+            char* path = strtok(NULL, "\"");
+
+            // The server reads the file itself, so it needs the full path
+            char full_path[PATH_MAX];
+            if (path == NULL || realpath(path, full_path) == NULL) {
+                log_err("Failed to open file\n");
+                free(str_cpy);
+                continue;
             }
-
-            // Always wait for server response (even if it is just an OK message)
-            if ((len = recv(client_socket, &(recv_message), sizeof(message), 0)) > 0) {
-                if (recv_message.status == OK_WAIT_FOR_RESPONSE &&
-                    (int) recv_message.length > 0) {
-                    // Calculate number of bytes in response package
-                    size_t num_bytes = recv_message.length;
-                    char payload[num_bytes + 1];
-
-                    size_t num_rows = recv_message.num_rows;
-                    size_t num_cols = recv_message.num_cols;
-
-                    size_t received = 0;
-                    char* payload_ptr = payload;
-                    
-                    // Receive the payload and print it out
-                    while(received < num_bytes && (len = recv(client_socket, payload_ptr, num_bytes, 0)) > 0) {
-                        payload_ptr += len;
-                        received += len;
+            free(str_cpy);
+
+            char load_query[PATH_MAX + 16];
+            send_message.status = OK_WAIT_FOR_RESPONSE;
+            send_message.length = snprintf(load_query, sizeof(load_query),
+                "load(\"%s\")\n", full_path);
+            send_message.payload = load_query;
+            send_query(client_socket, &send_message);
+            send_message.payload = read_buffer;
+            next_id++;
+
+            if (recv_header(client_socket, &recv_message) == 0) {
+                have_reply = true;
+                if (recv_message.status == LOAD_FROM_CLIENT) {
+                    // The server cannot see the file; send it the rows
+                    have_reply = false;
+                    if (!send_load_file(client_socket, &send_message, full_path)) {
+                        replied_id++;
+                        continue;
                     }
-                    payload[num_bytes] = '\0';
-
-                    if (recv_message.type == INT) {
-                        int* values = (int*)payload;
-                        for(size_t i = 0; i < num_rows; i++) {
-                            for(size_t j = 0; j < num_cols; j++) {
-                                printf("%d", values[i + j*num_rows]);
-                                if (j != num_cols -1) {
-                                    printf(",");
-                                }
-                            }
-                            printf("\n");
-                        }
-                    } else if (recv_message.type == LONG) {
-                        long* values = (long*)payload;
-                        for(size_t i = 0; i < num_rows; i++) {
-                            for(size_t j = 0; j < num_cols; j++) {
-                                printf("%ld", values[i + j*num_rows]);
-                                if (j != num_cols -1) {
-                                    printf(",");
-                                }
-                            }
-                            printf("\n");
-                        }
-                    } else if (recv_message.type == LONG_DOUBLE) {
-                        long double* values = (long double*)payload;
-                        for(size_t i = 0; i < num_rows; i++) {
-                            for(size_t j = 0; j < num_cols; j++) {
-                                printf("%.12Lf", values[i + j*num_rows]);
-                                if (j != num_cols -1) {
-                                    printf(",");
-                                }
-                            }
-                            printf("\n");
-                        }
-                    } else if (recv_message.type == CHAR) {
-                        log_info("%s", payload);
-                    }
-                } else if (recv_message.status == SHUTDOWN_CLIENT) {
-                    break;
+                    send_message.payload = read_buffer;
                 }
             }
-            else {
-                if (len < 0) {
-                    log_err("Failed to receive message.");
-                }
-                else {
-                    log_info("Server closed connection\n");
-                }
-                exit(1);
-            }
+
+        } else {
+            send_message.status = OK_WAIT_FOR_RESPONSE;
+            send_query(client_socket, &send_message);
+            next_id++;
+        }
+
+        // Wait for server responses (even if they are just OK messages)
+        // once the window is full
+        while (running && next_id - replied_id >= (sync ? 1 : window)) {
+            running = receive_reply(client_socket, &recv_message, have_reply, replied_id++,
+                &payload, &payload_capacity);
+            have_reply = false;
         }
     }
+
+    // Print what the last queries sent back
+    while (running && replied_id < next_id) {
+        running = receive_reply(client_socket, &recv_message, false, replied_id++,
+            &payload, &payload_capacity);
+    }
+
+    free(payload);
     close(client_socket);
     return 0;
-}
\ No newline at end of file
+}
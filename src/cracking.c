@@ -0,0 +1,235 @@
+#include <string.h>
+#include "cracking.h"
+#include "utils.h"
+
+#define DEFAULT_CRACK_BOUNDS 64
+#define DEFAULT_CRACK_PENDING 1024
+
+void free_cracker(cracker* c) {
+    if (!c) {
+        return;
+    }
+    free(c->vals);
+    free(c->positions);
+    free(c->bounds);
+    free(c->pending_vals);
+    free(c->pending_positions);
+    free(c);
+}
+
+status build_cracker_index(column* col) {
+    status s;
+
+    free_cracker((cracker*)col->index->index);
+    col->index->index = NULL;
+
+    cracker* c = calloc(1, sizeof(struct cracker));
+    if (!c) {
+        s.code = ERROR;
+        s.error_message = "Error allocating cracker\n";
+        return s;
+    }
+
+    c->count = col->data_count;
+    c->capacity = col->data_count ? col->data_count : 1;
+    c->vals = malloc(c->capacity * sizeof(int));
+    c->positions = malloc(c->capacity * sizeof(int));
+    c->bounds_capacity = DEFAULT_CRACK_BOUNDS;
+    c->bounds = malloc(c->bounds_capacity * sizeof(struct crack_boundary));
+    if (!c->vals || !c->positions || !c->bounds) {
+        free_cracker(c);
+        s.code = ERROR;
+        s.error_message = "Error allocating cracker\n";
+        return s;
+    }
+
+    memcpy(c->vals, col->data, col->data_count * sizeof(int));
+    for (size_t i = 0; i < col->data_count; i++) {
+        c->positions[i] = i;
+    }
+
+    col->index->index = c;
+    s.code = OK;
+    return s;
+}
+
+status cracker_insert(cracker* c, int val, int pos) {
+    status s;
+
+    if (c->num_pending == c->pending_capacity) {
+        size_t capacity = c->pending_capacity ? 2 * c->pending_capacity : DEFAULT_CRACK_PENDING;
+        int* vals = realloc(c->pending_vals, capacity * sizeof(int));
+        if (!vals) {
+            s.code = ERROR;
+            s.error_message = "Error growing cracker pending inserts\n";
+            return s;
+        }
+        c->pending_vals = vals;
+        int* positions = realloc(c->pending_positions, capacity * sizeof(int));
+        if (!positions) {
+            s.code = ERROR;
+            s.error_message = "Error growing cracker pending inserts\n";
+            return s;
+        }
+        c->pending_positions = positions;
+        c->pending_capacity = capacity;
+    }
+
+    c->pending_vals[c->num_pending] = val;
+    c->pending_positions[c->num_pending] = pos;
+    c->num_pending++;
+
+    s.code = OK;
+    return s;
+}
+
+// Ripples the pending inserts into their pieces. Each insert opens a hole
+// at the end of the cracker column and moves it down by swapping the first
+// value of every piece above the new value to the end of that piece.
+status merge_pending(cracker* c) {
+    status s;
+
+    if (c->count + c->num_pending > c->capacity) {
+        size_t capacity = c->capacity;
+        while (capacity < c->count + c->num_pending) {
+            capacity *= 2;
+        }
+        int* vals = realloc(c->vals, capacity * sizeof(int));
+        if (!vals) {
+            s.code = ERROR;
+            s.error_message = "Error growing cracker column\n";
+            return s;
+        }
+        c->vals = vals;
+        int* positions = realloc(c->positions, capacity * sizeof(int));
+        if (!positions) {
+            s.code = ERROR;
+            s.error_message = "Error growing cracker column\n";
+            return s;
+        }
+        c->positions = positions;
+        c->capacity = capacity;
+    }
+
+    for (size_t p = 0; p < c->num_pending; p++) {
+        int val = c->pending_vals[p];
+        size_t hole = c->count;
+        for (size_t b = c->num_bounds; b > 0 && c->bounds[b-1].key > val; b--) {
+            crack_boundary* bound = &(c->bounds[b-1]);
+            c->vals[hole] = c->vals[bound->start];
+            c->positions[hole] = c->positions[bound->start];
+            hole = bound->start;
+            bound->start++;
+        }
+        c->vals[hole] = val;
+        c->positions[hole] = c->pending_positions[p];
+        c->count++;
+    }
+    c->num_pending = 0;
+
+    s.code = OK;
+    return s;
+}
+
+// Index of the first boundary with a key >= key
+size_t find_boundary(cracker* c, int key) {
+    size_t lo = 0, hi = c->num_bounds;
+    while (lo < hi) {
+        size_t mid = (lo + hi) >> 1;
+        if (c->bounds[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Makes sure a boundary exists at key and returns where it starts. Only the
+// piece the key falls into is partitioned.
+status crack(cracker* c, int key, size_t* split) {
+    status s;
+
+    size_t b = find_boundary(c, key);
+    if (b < c->num_bounds && c->bounds[b].key == key) {
+        *split = c->bounds[b].start;
+        s.code = OK;
+        return s;
+    }
+
+    size_t lo = b > 0 ? c->bounds[b-1].start : 0;
+    size_t hi = b < c->num_bounds ? c->bounds[b].start : c->count;
+
+    // Partition [lo, hi) into values < key followed by values >= key
+    size_t i = lo, j = hi;
+    while (i < j) {
+        if (c->vals[i] < key) {
+            i++;
+        } else {
+            j--;
+            int val = c->vals[i];
+            c->vals[i] = c->vals[j];
+            c->vals[j] = val;
+            int pos = c->positions[i];
+            c->positions[i] = c->positions[j];
+            c->positions[j] = pos;
+        }
+    }
+
+    if (c->num_bounds == c->bounds_capacity) {
+        size_t capacity = 2 * c->bounds_capacity;
+        crack_boundary* bounds = realloc(c->bounds, capacity * sizeof(struct crack_boundary));
+        if (!bounds) {
+            s.code = ERROR;
+            s.error_message = "Error growing cracker index\n";
+            return s;
+        }
+        c->bounds = bounds;
+        c->bounds_capacity = capacity;
+    }
+    memmove(c->bounds + b + 1, c->bounds + b, (c->num_bounds - b) * sizeof(struct crack_boundary));
+    c->bounds[b].key = key;
+    c->bounds[b].start = i;
+    c->num_bounds++;
+
+    *split = i;
+    s.code = OK;
+    return s;
+}
+
+status crack_select(column* col, result* r, int lower, int upper) {
+    log_info("Cracking column\n");
+    status s;
+
+    cracker* c = (cracker*)col->index->index;
+    r->type = INT;
+    r->num_tuples = 0;
+
+    if (c->num_pending > 0) {
+        s = merge_pending(c);
+        if (s.code != OK) {
+            return s;
+        }
+    }
+
+    if (lower >= upper) {
+        s.code = OK;
+        return s;
+    }
+
+    size_t start, end;
+    s = crack(c, lower, &start);
+    if (s.code != OK) {
+        return s;
+    }
+    s = crack(c, upper, &end);
+    if (s.code != OK) {
+        return s;
+    }
+
+    memcpy(r->payload, c->positions + start, (end - start) * sizeof(int));
+    r->num_tuples = end - start;
+
+    s.code = OK;
+    return s;
+}
@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "csstree.h"
+#include "utils.h"
+
+// Allocates n ints on a cache line boundary
+int* alloc_node_keys(size_t n) {
+    void* keys = NULL;
+    if (posix_memalign(&keys, CSS_NODE_KEYS * sizeof(int), (n ? n : 1) * sizeof(int)) != 0) {
+        return NULL;
+    }
+    return (int*)keys;
+}
+
+// Number of keys in a node that are smaller than key.
+int css_node_rank(int* node, int key) {
+#ifdef __SSE2__
+    __m128i k = _mm_set1_epi32(key);
+    __m128i lt0 = _mm_cmpgt_epi32(k, _mm_load_si128((__m128i*)node));
+    __m128i lt1 = _mm_cmpgt_epi32(k, _mm_load_si128((__m128i*)(node + 4)));
+    __m128i lt2 = _mm_cmpgt_epi32(k, _mm_load_si128((__m128i*)(node + 8)));
+    __m128i lt3 = _mm_cmpgt_epi32(k, _mm_load_si128((__m128i*)(node + 12)));
+    __m128i lt = _mm_packs_epi16(_mm_packs_epi32(lt0, lt1), _mm_packs_epi32(lt2, lt3));
+    return __builtin_popcount(_mm_movemask_epi8(lt));
+#else
+    int rank = 0;
+    for (int i = 0; i < CSS_NODE_KEYS; i++) {
+        rank += node[i] < key;
+    }
+    return rank;
+#endif
+}
+
+void free_css_tree(css_tree* tree) {
+    if (!tree) {
+        return;
+    }
+    for (int l = 0; l < tree->num_levels; l++) {
+        free(tree->levels[l]);
+    }
+    free(tree->levels);
+    free(tree->level_nodes);
+    free(tree->keys);
+    free(tree->positions);
+    free(tree->pending_vals);
+    free(tree->pending_positions);
+    free(tree);
+}
+
+status build_css_tree(css_tree** tree, kv_pair* pairs, size_t num_pairs) {
+    status s;
+    s.code = ERROR;
+    s.error_message = "Error allocating CSS-tree\n";
+
+    css_tree* t = calloc(1, sizeof(struct css_tree));
+    if (!t) {
+        return s;
+    }
+
+    size_t num_blocks = (num_pairs + CSS_NODE_KEYS - 1) / CSS_NODE_KEYS;
+    t->num_keys = num_pairs;
+    t->keys = alloc_node_keys(num_blocks * CSS_NODE_KEYS);
+    t->positions = malloc((num_pairs ? num_pairs : 1) * sizeof(int));
+    if (!t->keys || !t->positions) {
+        free_css_tree(t);
+        return s;
+    }
+    for (size_t i = 0; i < num_pairs; i++) {
+        t->keys[i] = pairs[i].key;
+        t->positions[i] = pairs[i].pos;
+    }
+    for (size_t i = num_pairs; i < num_blocks * CSS_NODE_KEYS; i++) {
+        t->keys[i] = INT_MAX;
+    }
+
+    // Count the inner levels needed to get down to a single root
+    int num_levels = 0;
+    for (size_t n = num_blocks; n > 1; n = (n + CSS_FANOUT - 1) / CSS_FANOUT) {
+        num_levels++;
+    }
+    t->num_levels = num_levels;
+    t->levels = calloc(num_levels ? num_levels : 1, sizeof(int*));
+    t->level_nodes = calloc(num_levels ? num_levels : 1, sizeof(size_t));
+
+    // Max key under each node of the level being built on, leaves first
+    size_t below = num_blocks;
+    int* below_max = malloc((num_blocks ? num_blocks : 1) * sizeof(int));
+    if (!t->levels || !t->level_nodes || !below_max) {
+        free(below_max);
+        free_css_tree(t);
+        return s;
+    }
+    for (size_t b = 0; b < num_blocks; b++) {
+        size_t last = (b + 1) * CSS_NODE_KEYS < num_pairs ? (b + 1) * CSS_NODE_KEYS : num_pairs;
+        below_max[b] = t->keys[last - 1];
+    }
+
+    for (int l = num_levels - 1; l >= 0; l--) {
+        size_t nodes = (below + CSS_FANOUT - 1) / CSS_FANOUT;
+        int* level = alloc_node_keys(nodes * CSS_NODE_KEYS);
+        int* level_max = malloc(nodes * sizeof(int));
+        if (!level || !level_max) {
+            free(level);
+            free(level_max);
+            free(below_max);
+            free_css_tree(t);
+            return s;
+        }
+
+        for (size_t i = 0; i < nodes; i++) {
+            for (size_t j = 0; j < CSS_NODE_KEYS; j++) {
+                size_t child = i * CSS_FANOUT + j;
+                level[i * CSS_NODE_KEYS + j] = child < below ? below_max[child] : INT_MAX;
+            }
+            size_t last = (i + 1) * CSS_FANOUT < below ? (i + 1) * CSS_FANOUT : below;
+            level_max[i] = below_max[last - 1];
+        }
+
+        t->levels[l] = level;
+        t->level_nodes[l] = nodes;
+        free(below_max);
+        below_max = level_max;
+        below = nodes;
+    }
+    free(below_max);
+
+    *tree = t;
+    s.code = OK;
+    return s;
+}
+
+size_t css_lower_bound(css_tree* tree, int key) {
+    // A child past the end of its level means every key is smaller
+    size_t node = 0;
+    for (int l = 0; l < tree->num_levels; l++) {
+        if (node >= tree->level_nodes[l]) {
+            return tree->num_keys;
+        }
+        node = node * CSS_FANOUT + css_node_rank(tree->levels[l] + node * CSS_NODE_KEYS, key);
+    }
+
+    if (node * CSS_NODE_KEYS >= tree->num_keys) {
+        return tree->num_keys;
+    }
+
+    size_t idx = node * CSS_NODE_KEYS + css_node_rank(tree->keys + node * CSS_NODE_KEYS, key);
+    return idx < tree->num_keys ? idx : tree->num_keys;
+}
+
+status build_css_index(column* col) {
+    status s;
+
+    free_css_tree((css_tree*)col->index->index);
+    col->index->index = NULL;
+
+    kv_pair* pairs = sort_pairs(col->data, NULL, col->data_count);
+    if (!pairs) {
+        s.code = ERROR;
+        s.error_message = "Error sorting column for index\n";
+        return s;
+    }
+
+    s = build_css_tree((css_tree**)(&(col->index->index)), pairs, col->data_count);
+    free(pairs);
+    return s;
+}
+
+// Builds a new tree over the keys of @tree and its pending inserts. Equal
+// keys stay in position order, since inserts come after every tree key.
+status css_merge_pending(css_tree** tree) {
+    status s;
+    s.code = ERROR;
+    s.error_message = "Error merging CSS-tree inserts\n";
+
+    css_tree* t = *tree;
+    size_t total = t->num_keys + t->num_pending;
+    kv_pair* pending = sort_pairs(t->pending_vals, t->pending_positions, t->num_pending);
+    kv_pair* merged = malloc(total * sizeof(struct kv_pair));
+    if (!pending || !merged) {
+        free(pending);
+        free(merged);
+        return s;
+    }
+
+    size_t i = 0, j = 0;
+    for(size_t k = 0; k < total; k++) {
+        if (j == t->num_pending || (i < t->num_keys && t->keys[i] <= pending[j].key)) {
+            merged[k].key = t->keys[i];
+            merged[k].pos = t->positions[i];
+            i++;
+        } else {
+            merged[k] = pending[j++];
+        }
+    }
+    free(pending);
+
+    css_tree* fresh = NULL;
+    s = build_css_tree(&fresh, merged, total);
+    free(merged);
+    if (s.code != OK) {
+        return s;
+    }
+
+    free_css_tree(t);
+    *tree = fresh;
+    return s;
+}
+
+status css_insert(css_tree** tree, int val, int pos) {
+    status s;
+    css_tree* t = *tree;
+
+    if (!t->pending_vals) {
+        t->pending_vals = malloc(CSS_MERGE_THRESHOLD * sizeof(int));
+        t->pending_positions = malloc(CSS_MERGE_THRESHOLD * sizeof(int));
+        if (!t->pending_vals || !t->pending_positions) {
+            s.code = ERROR;
+            s.error_message = "Error allocating CSS-tree pending inserts\n";
+            return s;
+        }
+    }
+
+    t->pending_vals[t->num_pending] = val;
+    t->pending_positions[t->num_pending] = pos;
+    t->num_pending++;
+
+    if (t->num_pending == CSS_MERGE_THRESHOLD) {
+        return css_merge_pending(tree);
+    }
+
+    s.code = OK;
+    return s;
+}
+
+status find_range_css(column* col, result* r, int lower, int upper) {
+    log_info("Searching in CSS-tree\n");
+    status s;
+
+    css_tree* tree = (css_tree*)col->index->index;
+    size_t start = css_lower_bound(tree, lower);
+    size_t end = lower < upper ? css_lower_bound(tree, upper) : start;
+
+    int* payload = (int*)r->payload;
+    memcpy(payload, tree->positions + start, (end - start) * sizeof(int));
+    size_t j = end - start;
+    for(size_t i = 0; i < tree->num_pending; i++) {
+        payload[j] = tree->pending_positions[i];
+        j += lower <= tree->pending_vals[i] && tree->pending_vals[i] < upper;
+    }
+    r->type = INT;
+    r->num_tuples = j;
+
+    s.code = OK;
+    return s;
+}
@@ -1,8 +1,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "db.h"
+#include "helpers.h"
 #include "bpt.h"
+#include "csstree.h"
+#include "cracking.h"
+#include "sorted.h"
+#include "scan.h"
 
 // TODO(USER): Here we provide an incomplete implementation of the create_db.
 // There will be changes that you will need to include here.
@@ -92,10 +100,14 @@ status create_column(table *table, const char* name, column** col, bool sorted)
 	(*col)->name = malloc(strlen(name)+1);
 	strcpy((char *)(*col)->name, name);
 
-	(*col)->data = (int*) calloc(DEFAULT_NUM_VALS, sizeof(int));
+	(*col)->data = (int*) malloc(DEFAULT_COLUMN_CAPACITY * sizeof(int));
+	(*col)->capacity = DEFAULT_COLUMN_CAPACITY;
 	(*col)->index = NULL;
     (*col)->data_count = 0;
+    (*col)->map_base = NULL;
+    (*col)->map_len = 0;
     (*col)->leading = sorted;
+    (*col)->dirty = true;
 
     if (sorted) {
         table->leading_idx = table->col_count;
@@ -109,15 +121,42 @@ status create_column(table *table, const char* name, column** col, bool sorted)
 }
 
 status create_index(column* col, IndexType type) {
-    status s;
-    (void)type;// TODO ENSURE THIS IS BPT
     col->index = malloc(sizeof(struct column_index));
-    col->index->type = B_PLUS_TREE;
+    col->index->type = type;
     col->index->index = NULL;
-    s = build_secondary_bpt_index(col);
+    pthread_mutex_init(&col->index->lock, NULL);
+    return build_index(col);
+}
+
+status build_index(column* col) {
+    status s;
+
+    if (col->index->type == SORTED) {
+        return build_sorted_index(col);
+    } else if (col->index->type == B_PLUS_TREE) {
+        return build_secondary_bpt_index(col);
+    } else if (col->index->type == CSS_TREE) {
+        return build_css_index(col);
+    } else if (col->index->type == CRACKED) {
+        return build_cracker_index(col);
+    }
+
+    s.code = ERROR;
+    s.error_message = "Unsupported index type\n";
     return s;
 }
 
+// Values fetched from a leading column come out sorted; confirm it so
+// joins can skip sorting them.
+void check_fetched_sorted(result* r) {
+    if (r->source->leading) {
+        int* payload = (int*)r->payload;
+        size_t i = 1;
+        for(; i < r->num_tuples && payload[i-1] <= payload[i]; i++);
+        r->sorted = i >= r->num_tuples;
+    }
+}
+
 status fetch(column *col, int* indices, size_t val_count, result **r) {
     status s;
     
@@ -129,17 +168,219 @@ status fetch(column *col, int* indices, size_t val_count, result **r) {
     for(size_t i = 0; i < val_count; i++) {
         payload[i] = col->data[indices[i]];
     }
-    
+    (*r)->source = col;
+    check_fetched_sorted(*r);
+
+    s.code = OK;
+    return s;
+}
+
+status fetch_bitmap(column *col, result* pos, result **r) {
+    status s;
+
+    (*r)->payload = malloc((pos->num_tuples ? pos->num_tuples : 1) * sizeof(int));
+    if (!(*r)->payload) {
+        s.code = ERROR;
+        s.error_message = "Error allocating fetch result\n";
+        return s;
+    }
+    int* payload = (int*)(*r)->payload;
+    (*r)->type = INT;
+
+    uint64_t* bits = (uint64_t*)pos->payload;
+    size_t j = 0;
+    for(size_t w = 0; w * 64 < pos->num_bits; w++) {
+        for(uint64_t word = bits[w]; word; word &= word - 1) {
+            payload[j++] = col->data[w * 64 + __builtin_ctzll(word)];
+        }
+    }
+    (*r)->num_tuples = j;
+    (*r)->source = col;
+    check_fetched_sorted(*r);
+
     s.code = OK;
     return s;
 }
 
+status col_reserve(column* col, size_t num_vals) {
+    status s;
+
+    if (!col->map_base && num_vals <= col->capacity) {
+        s.code = OK;
+        return s;
+    }
+
+    // Double small columns; add whole chunks to large ones so growth never
+    // reserves more than COLUMN_GROWTH_CHUNK unused values.
+    size_t capacity = col->capacity > DEFAULT_COLUMN_CAPACITY ? col->capacity : DEFAULT_COLUMN_CAPACITY;
+    while (capacity < num_vals) {
+        capacity += capacity < COLUMN_GROWTH_CHUNK ? capacity : COLUMN_GROWTH_CHUNK;
+    }
+
+    int* data = malloc(capacity * sizeof(int));
+    if (!data) {
+        s.code = ERROR;
+        s.error_message = "Error allocating column\n";
+        return s;
+    }
+    memcpy(data, col->data, col->data_count * sizeof(int));
+
+    // B+tree leaves point into the column data
+    if (col->index && col->index->type == B_PLUS_TREE && col->index->index) {
+        update_bpt_pointers((node*)col->index->index, col->data, data);
+    }
+
+    free_column_data(col);
+    col->data = data;
+    col->capacity = capacity;
+
+    s.code = OK;
+    return s;
+}
+
+void free_column_data(column* col) {
+    if (col->map_base) {
+        munmap(col->map_base, col->map_len);
+    } else {
+        free(col->data);
+    }
+    col->data = NULL;
+    col->capacity = 0;
+    col->map_base = NULL;
+    col->map_len = 0;
+}
+
 status col_insert(column *col, int data) {
     status s;
 
+    if (col->data_count == col->capacity) {
+        s = col_reserve(col, col->data_count + 1);
+        if (s.code != OK) {
+            return s;
+        }
+    }
+
     size_t i = col->data_count;
     col->data[i] = data;
     col->data_count++;
+    col->dirty = true;
+
+    // Cracked columns merge new values lazily on their next select
+    if (col->index && col->index->type == CRACKED && col->index->index) {
+        return cracker_insert((cracker*)col->index->index, data, i);
+    }
+
+    // Sorted projections are re-sorted on their next select
+    if (col->index && col->index->type == SORTED && col->index->index) {
+        ((sorted_index*)col->index->index)->stale = true;
+    }
+
+    // B+tree leaves take new keys in the room bulk loading left them
+    if (col->index && col->index->type == B_PLUS_TREE && col->index->index) {
+        return insert_bpt((node**)&col->index->index, data, col->data + i);
+    }
+
+    // CSS-trees are static; new values wait beside the tree until a merge
+    if (col->index && col->index->type == CSS_TREE && col->index->index) {
+        return css_insert((css_tree**)&col->index->index, data, i);
+    }
+
+    s.code = OK;
+    return s;
+}
+
+void invalidate_index(column* col) {
+    if (!col->index || !col->index->index) {
+        return;
+    }
+
+    if (col->index->type == SORTED) {
+        free_sorted_index((sorted_index*)col->index->index);
+    } else if (col->index->type == B_PLUS_TREE) {
+        free_bpt((node*)col->index->index);
+    } else if (col->index->type == CSS_TREE) {
+        free_css_tree((css_tree*)col->index->index);
+    } else if (col->index->type == CRACKED) {
+        free_cracker((cracker*)col->index->index);
+    }
+    col->index->index = NULL;
+}
+
+status insert_row(table* tbl, int* vals) {
+    status s;
+
+    for(size_t i = 0; i < tbl->col_count; i++) {
+        s = col_insert(tbl->col[i], vals[i]);
+        if (s.code != OK) {
+            return s;
+        }
+    }
+
+    s.code = OK;
+    return s;
+}
+
+status update(column *col, int *pos, size_t num_pos, int new_val) {
+    status s;
+
+    for(size_t i = 0; i < num_pos; i++) {
+        if (pos[i] < 0 || (size_t)pos[i] >= col->data_count) {
+            s.code = ERROR;
+            s.error_message = "Update position out of range\n";
+            return s;
+        }
+    }
+
+    for(size_t i = 0; i < num_pos; i++) {
+        col->data[pos[i]] = new_val;
+    }
+    col->dirty = true;
+
+    if (num_pos > 0) {
+        invalidate_index(col);
+    }
+
+    s.code = OK;
+    return s;
+}
+
+status delete(table* tbl, int *pos, size_t num_pos) {
+    status s;
+
+    if (tbl->col_count == 0 || num_pos == 0) {
+        s.code = OK;
+        return s;
+    }
+
+    size_t num_rows = tbl->col[0]->data_count;
+    char* deleted = calloc(num_rows ? num_rows : 1, sizeof(char));
+    if (!deleted) {
+        s.code = ERROR;
+        s.error_message = "Error allocating delete map\n";
+        return s;
+    }
+    for(size_t i = 0; i < num_pos; i++) {
+        if (pos[i] < 0 || (size_t)pos[i] >= num_rows) {
+            free(deleted);
+            s.code = ERROR;
+            s.error_message = "Delete position out of range\n";
+            return s;
+        }
+        deleted[pos[i]] = 1;
+    }
+
+    for(size_t i = 0; i < tbl->col_count; i++) {
+        column* col = tbl->col[i];
+        size_t kept = 0;
+        for(size_t j = 0; j < col->data_count; j++) {
+            col->data[kept] = col->data[j];
+            kept += !deleted[j];
+        }
+        col->data_count = kept;
+        col->dirty = true;
+        invalidate_index(col);
+    }
+    free(deleted);
 
     s.code = OK;
     return s;
@@ -151,8 +392,7 @@ status process_indexes(table* tbl) {
     for(size_t i = 0; i < tbl->col_count; i++) {
         column* col = tbl->col[i];
         if (col->index) {
-            //TODO asssert that index is bpt
-            s = build_secondary_bpt_index(col);
+            s = build_index(col);
             if (s.code != OK) {
                 return s;
             }
@@ -167,8 +407,11 @@ status select_data(db_operator* query, result **r) {
     int lower = query->lower;
     int upper = query->upper;
     column* col = *(query->columns);
+    (*r)->distinct = true;
     if (col->leading || col->index) {
         return index_scan(lower, upper, col, r);
+    } else if (col->data_count >= PARALLEL_SCAN_THRESHOLD && DEFAULT_NUM_THREADS > 1) {
+        return col_scan_parallel(query, r);
     } else {
         return col_scan(lower, upper, col, r);
     }
@@ -181,38 +424,229 @@ status index_scan(int lower, int upper, column *col, result **r) {
     (*r)->type = INT;
     (*r)->num_tuples = 0;
 
-    if (col->index) {
-        //TODO assert type is bpt col->index->type
+    if (!col->index) {
+        s.code = ERROR;
+        s.error_message = "No index specified\n";
+        return s;
+    }
+
+    // Other clients may be reading the same column; building an index and
+    // cracking change it, so they happen under the index lock. B+tree,
+    // CSS-tree and sorted index searches only read.
+    pthread_mutex_lock(&col->index->lock);
+    if (!col->index->index || (col->index->type == SORTED &&
+            ((sorted_index*)col->index->index)->stale)) {
+        s = build_index(col);
+        if (s.code != OK) {
+            pthread_mutex_unlock(&col->index->lock);
+            return s;
+        }
+    }
+    if (col->index->type == CRACKED) {
+        s = crack_select(col, *r, lower, upper);
+        pthread_mutex_unlock(&col->index->lock);
+        return s;
+    }
+    pthread_mutex_unlock(&col->index->lock);
+
+    if (col->index->type == SORTED) {
+        return find_range_sorted(col, *r, lower, upper);
+    } else if (col->index && col->index->type == B_PLUS_TREE) {
         return find_range_bpt(col, *r, lower, upper);
+    } else if (col->index && col->index->type == CSS_TREE) {
+        return find_range_css(col, *r, lower, upper);
     }
 
     s.code = ERROR;
-    s.error_message = "No index specified\n";
+    s.error_message = "Unsupported index type\n";
     return s;
 }
 
+/**
+ * init_select_output(r, num_rows, bitmap)
+ * Gives @r room for the result of a select over @num_rows rows: a bitmap
+ * of them, its words written by the scan, or a position for each.
+ **/
+status init_select_output(result* r, size_t num_rows, bool bitmap) {
+    status s;
+
+    if (bitmap) {
+        size_t num_words = (num_rows + 63) / 64;
+        r->payload = malloc((num_words ? num_words : 1) * sizeof(uint64_t));
+        r->type = BITMAP;
+        r->num_bits = num_rows;
+    } else {
+        r->payload = calloc(num_rows ? num_rows : 1, sizeof(int));
+        r->type = INT;
+    }
+    r->num_tuples = 0;
+
+    if (!r->payload) {
+        s.code = ERROR;
+        s.error_message = "Select allocation failed\n";
+        return s;
+    }
+    s.code = OK;
+    return s;
+}
+
+/**
+ * trim_positions(r)
+ * Position lists are allocated for every row scanned; gives back the room
+ * a select did not use.
+ **/
+void trim_positions(result* r) {
+    if (r->type == INT) {
+        int* payload = realloc(r->payload, (r->num_tuples ? r->num_tuples : 1) * sizeof(int));
+        r->payload = payload ? payload : r->payload;
+    }
+}
+
 status col_scan(int lower, int upper, column *col, result **r) {
     status s;
 
-    (*r)->payload = calloc(col->data_count, sizeof(int));
+    // Dense results are smaller as bitmaps, and cheaper to build
+    bool bitmap = select_prefers_bitmap(col->data, col->data_count, lower, upper);
+    s = init_select_output(*r, col->data_count, bitmap);
+    if (s.code != OK) {
+        return s;
+    }
+
+    if (bitmap) {
+        (*r)->num_tuples = select_bitmap(col->data, col->data_count, lower, upper,
+            (uint64_t*)(*r)->payload);
+    } else {
+        (*r)->num_tuples = select_range(col->data, NULL, col->data_count, lower, upper,
+            0, (int*)(*r)->payload);
+        trim_positions(*r);
+    }
+
+    return s;
+}
+
+// Scans rows [start, end) of the query column. Qualifying positions, or
+// bits, are written from args->res->payload onwards, which points at row
+// start of the shared output, so a chunk can never overrun its neighbour.
+void* col_scan_worker(void* arg) {
+    thread_args* args = (thread_args*)arg;
+    column* col = *(args->query->columns);
+    int lower = args->query->lower;
+    int upper = args->query->upper;
+
+    if (args->res->type == BITMAP) {
+        args->res->num_tuples = select_bitmap(col->data + args->start,
+            args->end - args->start, lower, upper, (uint64_t*)args->res->payload);
+    } else {
+        args->res->num_tuples = select_range(col->data + args->start, NULL,
+            args->end - args->start, lower, upper, args->start, (int*)args->res->payload);
+    }
+
+    return NULL;
+}
+
+status col_scan_parallel(db_operator* query, result **r) {
+    status s;
+
+    column* col = *(query->columns);
+    size_t num_threads = DEFAULT_NUM_THREADS;
+    size_t chunk = (col->data_count + num_threads - 1) / num_threads;
+    // Whole bitmap words, so chunks never share one
+    chunk = (chunk + 63) / 64 * 64;
+
+    bool bitmap = select_prefers_bitmap(col->data, col->data_count, query->lower, query->upper);
+    s = init_select_output(*r, col->data_count, bitmap);
+    if (s.code != OK) {
+        return s;
+    }
     int* payload = (int*)(*r)->payload;
-    (*r)->type = INT;
+    uint64_t* bits = (uint64_t*)(*r)->payload;
+
+    pthread_t threads[num_threads];
+    thread_args args[num_threads];
+    result parts[num_threads];
+    bool started[num_threads];
+
+    for(size_t t = 0; t < num_threads; t++) {
+        args[t].query = query;
+        args[t].res = &parts[t];
+        args[t].start = t*chunk < col->data_count ? t*chunk : col->data_count;
+        args[t].end = (t+1)*chunk < col->data_count ? (t+1)*chunk : col->data_count;
+        parts[t].payload = bitmap ? (void*)(bits + args[t].start / 64) :
+            (void*)(payload + args[t].start);
+        parts[t].num_tuples = 0;
+        parts[t].type = (*r)->type;
+
+        // Run the chunk inline if we can't get another thread
+        started[t] = pthread_create(&threads[t], NULL, col_scan_worker, &args[t]) == 0;
+        if (!started[t]) {
+            col_scan_worker(&args[t]);
+        }
+    }
+
+    // Merge in chunk order so positions stay sorted
     size_t j = 0;
-    for(size_t i = 0; i < col->data_count; i++) {
-        int data = col->data[i];
-        int qualifies = check_data(data, lower, upper);
-        payload[j] = i*qualifies;
-        j += qualifies;
+    for(size_t t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+        if (!bitmap && j != args[t].start) {
+            memmove(payload + j, parts[t].payload, parts[t].num_tuples*sizeof(int));
+        }
+        j += parts[t].num_tuples;
     }
     (*r)->num_tuples = j;
-    
+    trim_positions(*r);
+
     s.code = OK;
     return s;
 }
 
+// Selects from values fetched at the positions of a bitmap. Rows whose
+// value qualifies keep their bit, so the output covers the same rows; it
+// becomes a position list if too few are left for a bitmap to pay off.
+status vec_scan_bitmap(db_operator* query, result** r) {
+    status s;
+
+    int lower = query->lower;
+    int upper = query->upper;
+    result* pos = query->result1;
+    int* vals = (int*)query->result2->payload;
+
+    s = init_select_output(*r, pos->num_bits, true);
+    if (s.code != OK) {
+        return s;
+    }
+    uint64_t* in = (uint64_t*)pos->payload;
+    uint64_t* out = (uint64_t*)(*r)->payload;
+
+    size_t i = 0;
+    size_t count = 0;
+    for(size_t w = 0; w * 64 < pos->num_bits; w++) {
+        uint64_t kept = 0;
+        for(uint64_t word = in[w]; word; word &= word - 1, i++) {
+            uint64_t qualifies = lower <= vals[i] && vals[i] < upper;
+            kept |= word & -word & -qualifies;
+        }
+        out[w] = kept;
+        count += __builtin_popcountll(kept);
+    }
+    (*r)->num_tuples = count;
+
+    if (count * BITMAP_SELECTIVITY <= pos->num_bits) {
+        return materialize_positions(*r);
+    }
+    return s;
+}
+
 status vec_scan(db_operator* query, result** r) {
     status s;
 
+    // A subset of the input positions, so it repeats none they don't
+    (*r)->distinct = query->result1->distinct || query->result1->type == BITMAP;
+    if (query->result1->type == BITMAP) {
+        return vec_scan_bitmap(query, r);
+    }
+
     int lower = query->lower;
     int upper = query->upper;
     int* pos1 = (int*)query->result1->payload;
@@ -222,14 +656,60 @@ status vec_scan(db_operator* query, result** r) {
     (*r)->payload = calloc(num_vals, sizeof(int));
     int* payload = (int*)(*r)->payload;
     (*r)->type = INT;
-    size_t j = 0;
-    for(size_t i = 0; i < num_vals; i++) {
-        int data = val1[i];
-        int qualifies = check_data(data, lower, upper);
-        payload[j] = pos1[i]*qualifies;
-        j += qualifies;
+    (*r)->num_tuples = select_range(val1, pos1, num_vals, lower, upper, 0, payload);
+    trim_positions(*r);
+
+    s.code = OK;
+    return s;
+}
+
+// Answers every select queued on q->col in one pass over the column. The
+// column is walked in blocks of SHARED_SCAN_BLOCK_SIZE rows and each block is
+// checked against all queued predicates while it is still in cache.
+status shared_scan(select_queue* q) {
+    status s;
+
+    column* col = q->col;
+    size_t num_queries = q->buffer_count;
+    size_t counts[num_queries];
+
+    // Each select gets a bitmap or positions as if it ran alone
+    for(size_t k = 0; k < num_queries; k++) {
+        db_operator* query = q->buffer[k]->query;
+        bool bitmap = select_prefers_bitmap(col->data, col->data_count,
+            query->lower, query->upper);
+        s = init_select_output(q->buffer[k]->res, col->data_count, bitmap);
+        if (s.code != OK) {
+            return s;
+        }
+        q->buffer[k]->res->distinct = true;
+        counts[k] = 0;
+    }
+
+    for(size_t block = 0; block < col->data_count; block += SHARED_SCAN_BLOCK_SIZE) {
+        size_t end = block + SHARED_SCAN_BLOCK_SIZE;
+        if (end > col->data_count) {
+            end = col->data_count;
+        }
+
+        for(size_t k = 0; k < num_queries; k++) {
+            int lower = q->buffer[k]->query->lower;
+            int upper = q->buffer[k]->query->upper;
+            result* res = q->buffer[k]->res;
+            if (res->type == BITMAP) {
+                counts[k] += select_bitmap(col->data + block, end - block,
+                    lower, upper, (uint64_t*)res->payload + block / 64);
+            } else {
+                counts[k] += select_range(col->data + block, NULL, end - block,
+                    lower, upper, block, (int*)res->payload + counts[k]);
+            }
+        }
+    }
+
+    for(size_t k = 0; k < num_queries; k++) {
+        q->buffer[k]->res->num_tuples = counts[k];
+        trim_positions(q->buffer[k]->res);
     }
-    (*r)->num_tuples = j;
 
     s.code = OK;
     return s;
@@ -267,7 +747,7 @@ status sub_col(int* vals1, int* vals2, size_t num_vals, result** r) {
 status max_col(result* inter, result** r) {
     status s;
 
-    (*r)->type = inter->type;
+    (*r)->type = inter->type == BITMAP ? INT : inter->type;
     (*r)->num_tuples = 1;
 
     if (inter->type == INT) {
@@ -292,6 +772,18 @@ status max_col(result* inter, result** r) {
             }
         }
         *((long*)(*r)->payload) = max;
+    } else if (inter->type == BITMAP) {
+        // Positions in a bitmap are in order: the last one set is the largest
+        (*r)->payload = malloc(sizeof(int));
+        uint64_t* bits = (uint64_t*)inter->payload;
+        int max = INT_MIN;
+        for(size_t w = (inter->num_bits + 63) / 64; w-- > 0;) {
+            if (bits[w]) {
+                max = (int)(w * 64 + 63 - __builtin_clzll(bits[w]));
+                break;
+            }
+        }
+        *((int*)(*r)->payload) = max;
     } else {
         s.code = ERROR;
         s.error_message = "Intermediate result has no type\n";
@@ -305,7 +797,7 @@ status max_col(result* inter, result** r) {
 status min_col(result* inter, result** r) {
     status s;
 
-    (*r)->type = inter->type;
+    (*r)->type = inter->type == BITMAP ? INT : inter->type;
     (*r)->num_tuples = 1;
 
     if (inter->type == INT) {
@@ -330,6 +822,18 @@ status min_col(result* inter, result** r) {
             }
         }
         *((long*)(*r)->payload) = min;
+    } else if (inter->type == BITMAP) {
+        // Positions in a bitmap are in order: the first one set is the least
+        (*r)->payload = malloc(sizeof(int));
+        uint64_t* bits = (uint64_t*)inter->payload;
+        int min = INT_MAX;
+        for(size_t w = 0; w * 64 < inter->num_bits; w++) {
+            if (bits[w]) {
+                min = (int)(w * 64 + __builtin_ctzll(bits[w]));
+                break;
+            }
+        }
+        *((int*)(*r)->payload) = min;
     } else {
         s.code = ERROR;
         s.error_message = "Intermediate result has no type\n";
@@ -350,8 +854,17 @@ status avg_col(result* inter, result** r) {
 
     long double avg = 0.0;
     long double num_vals = (long double)inter->num_tuples;
-    for(size_t i = 0; i < num_vals; i++) {
-        avg += ((long double)vals[i])/num_vals;
+    if (inter->type == BITMAP) {
+        uint64_t* bits = (uint64_t*)inter->payload;
+        for(size_t w = 0; w * 64 < inter->num_bits; w++) {
+            for(uint64_t word = bits[w]; word; word &= word - 1) {
+                avg += ((long double)(w * 64 + __builtin_ctzll(word)))/num_vals;
+            }
+        }
+    } else {
+        for(size_t i = 0; i < num_vals; i++) {
+            avg += ((long double)vals[i])/num_vals;
+        }
     }
 
     (*r)->num_tuples = 1;
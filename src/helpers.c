@@ -1,6 +1,14 @@
 #include "helpers.h"
 #include "utils.h"
+#include "wal.h"
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // This tells the linker that there exists a global_db and catalog external
 // from this file.
@@ -9,126 +17,175 @@ extern catalog** catalogs;
 
 // PARSER FUNCTIONS
 
-int find_table(char* tbl_name) {
+int find_table(const char* tbl_name, size_t len) {
+    if (!global_db) {
+        return -1;
+    }
     for(size_t i = 0; i < global_db->table_count; i++) {
-        if (strcmp(global_db->tables[i]->name, tbl_name) == 0) {
+        const char* name = global_db->tables[i]->name;
+        if (strncmp(name, tbl_name, len) == 0 && name[len] == '\0') {
             return i;
         }
     }
     return -1;
 }
 
-int find_column(table* tbl, char* col_name) {
+int find_column(table* tbl, const char* col_name, size_t len) {
     for (int i = 0; i < (int)tbl->col_count; i++) {
-        if (strcmp(tbl->col[i]->name, col_name) == 0) {
+        const char* name = tbl->col[i]->name;
+        if (strncmp(name, col_name, len) == 0 && name[len] == '\0') {
             return i;
         }
     }
     return -1;
 }
 
-int find_table_from_col_name(char* col_name) {
-    char tbl_name[strlen(col_name)];
-    memset(tbl_name, '\0', strlen(col_name)); 
-    strcat(tbl_name, strtok(col_name, "."));
-    strcat(tbl_name, ".");
-    strcat(tbl_name, strtok(NULL, "."));
-
-    return find_table(tbl_name);
-}
-
-int create_lower_bound(char* val) {
-    if (strcmp("null", val) == 0) {
-        return INT_MIN;
+int find_table_from_col_name(const char* col_name, size_t len) {
+    // The table is everything before the last '.'
+    while (len > 0 && col_name[len - 1] != '.') {
+        len--;
+    }
+    if (len == 0) {
+        return -1;
     }
-    return atoi(val);
+    return find_table(col_name, len - 1);
 }
 
-int create_upper_bound(char* val) {
-    if (strcmp("null", val) == 0) {
-        return INT_MAX;
+/**
+ * find_slot(vars, name, len)
+ * The slot of @vars holding the variable @name, or the empty slot it
+ * would go in. @vars must have room.
+ **/
+catalog_entry* find_slot(catalog* vars, const char* name, size_t len) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) name[i]) * 1099511628211ULL;
+    }
+
+    size_t mask = vars->capacity - 1;
+    for(size_t i = hash & mask; ; i = (i + 1) & mask) {
+        catalog_entry* e = vars->entries + i;
+        if (!e->name || (strncmp(e->name, name, len) == 0 && e->name[len] == '\0')) {
+            return e;
+        }
     }
-    return atoi(val);
 }
 
-result* find_result(char* name) {
-    for(size_t i = 0; i < catalogs[0]->var_count; i++) {
-        if ((strlen(catalogs[0]->names[i]) == strlen(name)) && strncmp(catalogs[0]->names[i], name, strlen(catalogs[0]->names[i])) == 0) {
-            return catalogs[0]->results[i];
-        }
+result* find_result(const char* name, size_t len) {
+    catalog* vars = current_session->vars;
+    if (vars->capacity == 0) {
+        return NULL;
     }
-    return NULL;
+    return find_slot(vars, name, len)->res;
 }
 
-status prepare_result(char* var_name, result** r) {
+status bind_result(const char* name, result* r) {
     status s;
-
-    *r = find_result(var_name);
-    if (*r) {
+    catalog* vars = current_session->vars;
+    size_t len = strlen(name);
+
+    // Rebinding a name drops the result it had
+    catalog_entry* e = vars->capacity ? find_slot(vars, name, len) : NULL;
+    if (e && e->name) {
+        free_result(e->res);
+        e->res = r;
         s.code = OK;
         return s;
     }
 
-    char col_name[strlen(var_name)];
-    strcpy(col_name, var_name);
+    // Keep the table at most half full
+    if (2 * (vars->var_count + 1) > vars->capacity) {
+        size_t capacity = vars->capacity ? 2 * vars->capacity : DEFAULT_CATALOG_CAPACITY;
+        catalog_entry* old = vars->entries;
+        size_t old_capacity = vars->capacity;
 
-    int tbl_idx = find_table_from_col_name(var_name);
-    if (tbl_idx == -1) {
-        s.code = ERROR;
-        s.error_message = "Cannot find var\n";
-        return s;
+        vars->entries = calloc(capacity, sizeof(struct catalog_entry));
+        if (!vars->entries) {
+            vars->entries = old;
+            s.code = ERROR;
+            s.error_message = "Catalog allocation failed\n";
+            return s;
+        }
+        vars->capacity = capacity;
+        for(size_t i = 0; i < old_capacity; i++) {
+            if (old[i].name) {
+                *find_slot(vars, old[i].name, strlen(old[i].name)) = old[i];
+            }
+        }
+        free(old);
     }
-    table* table1 = global_db->tables[tbl_idx];
 
-    int col_idx = find_column(table1, col_name);
-    if (col_idx == -1) {
+    char* copy = strdup(name);
+    if (!copy) {
         s.code = ERROR;
-        s.error_message = "Cannot find var\n";
+        s.error_message = "Catalog allocation failed\n";
         return s;
     }
-    column* col1 = table1->col[col_idx];
-
-    *r = malloc(sizeof(struct result));
-    (*r)->payload = col1->data;
-    (*r)->num_tuples = col1->data_count;
-    (*r)->type = INT;
+    e = find_slot(vars, name, len);
+    e->name = copy;
+    e->res = r;
+    vars->var_count++;
 
     s.code = OK;
     return s;
 }
 
-status relational_insert(int tbl_idx, char* vals, db_operator* op) {
-    table *table1 = global_db->tables[tbl_idx];
-
-    char comma[2] = ",";
-    status s;
-    char* val = strtok(vals, comma);
-    int i = 0;
+// SERVER FUNCTIONS
 
-    op->value1 = calloc(table1->col_count, sizeof(int));
-    op->type = INSERT;
-    op->tables = (table**)(global_db->tables + tbl_idx);
-    op->columns = table1->col;
-    
-    while(val && i < (int)table1->col_count) {
-        op->value1[i] = atoi(val);
-        val = strtok(NULL, comma);
-        i++;
+catalog** init_catalogs() {
+    catalog** new_catalogs = calloc(DEFAULT_NUM_CLIENTS_ALLOWED, sizeof(struct catalog*));
+    for(int i=0; i < DEFAULT_NUM_CLIENTS_ALLOWED; i++) {
+        new_catalogs[i] = calloc(1, sizeof(struct catalog));
     }
+    return new_catalogs;
+}
+
+// Column files start with this header, followed by num_vals raw ints.
+typedef struct column_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_vals;
+} column_file_header;
+
+#define COLUMN_FILE_MAGIC 0x4c4f4353  // "SCOL"
+#define COLUMN_FILE_VERSION 1
+
+void column_file_path(char* path, size_t len, const char* col_name, const char* suffix) {
+    snprintf(path, len, "%s/%s.bin%s", DATA_DIR, col_name, suffix);
+}
+
+// Writes the column values to their own file, through a temporary file so
+// a failed write never clobbers the previous copy.
+status write_column_data(column* col1) {
+    status s;
 
-    if (val) {
-        free(op->value1);
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    column_file_path(path, PATH_MAX, col1->name, "");
+    column_file_path(tmp_path, PATH_MAX, col1->name, ".tmp");
 
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
         s.code = ERROR;
-        s.error_message = "Values exceed number of columns\n";
+        s.error_message = "Error opening column file\n";
         return s;
     }
 
-    if (i != (int)table1->col_count) {
-        free(op->value1);
+    column_file_header header = {COLUMN_FILE_MAGIC, COLUMN_FILE_VERSION, col1->data_count};
+    if (write_fully(fd, &header, sizeof(header)) == -1 ||
+            write_fully(fd, col1->data, col1->data_count * sizeof(int)) == -1 ||
+            fsync(fd) == -1) {
+        close(fd);
+        unlink(tmp_path);
+        s.code = ERROR;
+        s.error_message = "Error writing column file\n";
+        return s;
+    }
+    close(fd);
 
+    if (rename(tmp_path, path) == -1) {
         s.code = ERROR;
-        s.error_message = "Not enough values to insert\n";
+        s.error_message = "Error writing column file\n";
         return s;
     }
 
@@ -136,21 +193,6 @@ status relational_insert(int tbl_idx, char* vals, db_operator* op) {
     return s;
 }
 
-// SERVER FUNCTIONS
-
-catalog** init_catalogs() {
-    catalog** new_catalogs = calloc(DEFAULT_NUM_CLIENTS_ALLOWED, sizeof(struct catalog*));
-    for(int i=0; i < DEFAULT_NUM_CLIENTS_ALLOWED; i++) {
-        new_catalogs[i] = malloc(sizeof(struct catalog));
-        new_catalogs[i]->var_count = 0;
-        for(int j=0; j < DEFAULT_CATALOG_RESULTS; j++) {
-            new_catalogs[i]->names[j] = NULL;
-            new_catalogs[i]->results[j] = NULL;    
-        } 
-    }
-    return new_catalogs;
-}
-
 status write_column(FILE* f, column* col1) {
     status s;
 
@@ -165,18 +207,23 @@ status write_column(FILE* f, column* col1) {
         fprintf(f, "sorted\n");
     } else if (col1->index && col1->index->type == B_PLUS_TREE) {
         fprintf(f, "b_plus_tree\n");
+    } else if (col1->index && col1->index->type == CSS_TREE) {
+        fprintf(f, "css_tree\n");
+    } else if (col1->index && col1->index->type == CRACKED) {
+        fprintf(f, "cracked\n");
     } else{
         fprintf(f, "none\n");
     }
     fprintf(f, "%zu\n", col1->data_count);
-    for(int i = 0; i < (int)col1->data_count; i++) {
-        fprintf(f, "%d\n", col1->data[i]);
-    }
 
-    // Free memory
-    free((char*)(col1->name));
-    free(col1->data);
-    free(col1);
+    // Columns unchanged since the last checkpoint are already on disk
+    if (col1->dirty) {
+        s = write_column_data(col1);
+        if (s.code != OK) {
+            return s;
+        }
+        col1->dirty = false;
+    }
 
     s.code = OK;
     return s;
@@ -194,10 +241,6 @@ status write_table(FILE* f, table* table1) {
         }
     }
 
-    free((char*)(table1->name));
-    free(table1->col);
-    free(table1);
-
     s.code = OK;
     return s;
 }
@@ -206,6 +249,7 @@ status write_db(FILE* f) {
     status s;
 
     fprintf(f, "%s\n", global_db->name);
+    fprintf(f, "%llu\n", (unsigned long long)wal_last_lsn());
     fprintf(f, "%zu\n", global_db->table_count);
     for(int i = 0; i < (int)global_db->table_count; i++) {
         s = write_table(f, global_db->tables[i]);
@@ -214,12 +258,37 @@ status write_db(FILE* f) {
         }
     }
 
+    s.code = OK;
+    return s;
+}
+
+void free_db() {
+    if (!global_db) {
+        return;
+    }
+
+    for(size_t i = 0; i < global_db->table_count; i++) {
+        table* table1 = global_db->tables[i];
+        for(size_t j = 0; j < table1->col_count; j++) {
+            column* col1 = table1->col[j];
+            free((char*)(col1->name));
+            if (col1->index) {
+                invalidate_index(col1);
+                pthread_mutex_destroy(&col1->index->lock);
+                free(col1->index);
+            }
+            free_column_data(col1);
+            free(col1);
+        }
+        free((char*)(table1->name));
+        free(table1->col);
+        free(table1);
+    }
+
     free((char*)(global_db->name));
     free(global_db->tables);
     free(global_db);
-
-    s.code = OK;
-    return s;
+    global_db = NULL;
 }
 
 status persist_data() {
@@ -230,22 +299,115 @@ status persist_data() {
         return s;
     }
 
-    FILE* f = fopen("db.txt", "w");
+    if (mkdir(DATA_DIR, 0755) == -1 && errno != EEXIST) {
+        s.code = ERROR;
+        s.error_message = "Error creating data directory\n";
+        return s;
+    }
+
+    // The catalog is replaced last, so it only ever names complete files
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", DATA_DIR, CATALOG_FILE);
+    snprintf(tmp_path, PATH_MAX, "%s/%s.tmp", DATA_DIR, CATALOG_FILE);
+
+    FILE* f = fopen(tmp_path, "w");
     if (f == NULL) {
-        f = fopen("db.txt", "aw");
+        s.code = ERROR;
+        s.error_message = "Error opening catalog file\n";
+        return s;
     }
     s = write_db(f);
-    fclose(f);
+    if ((fflush(f) != 0 || fsync(fileno(f)) == -1) && s.code == OK) {
+        s.code = ERROR;
+        s.error_message = "Error writing catalog file\n";
+    }
+    if (fclose(f) != 0 && s.code == OK) {
+        s.code = ERROR;
+        s.error_message = "Error writing catalog file\n";
+    }
     if (s.code != OK) {
         return s;
     }
 
+    if (rename(tmp_path, path) == -1) {
+        s.code = ERROR;
+        s.error_message = "Error writing catalog file\n";
+        return s;
+    }
+
+    // Make the renames durable before the log they replace goes away
+    int dir_fd = open(DATA_DIR, O_RDONLY);
+    if (dir_fd == -1 || fsync(dir_fd) == -1) {
+        if (dir_fd != -1) {
+            close(dir_fd);
+        }
+        s.code = ERROR;
+        s.error_message = "Error syncing data directory\n";
+        return s;
+    }
+    close(dir_fd);
+
+    return wal_truncate();
+}
+
+// Maps the column file privately instead of reading it, so startup does no
+// I/O for column data and pages are read in as queries touch them.
+status map_column_data(column* col1, size_t num_data) {
+    status s;
+
+    char path[PATH_MAX];
+    column_file_path(path, PATH_MAX, col1->name, "");
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        s.code = ERROR;
+        s.error_message = "Error opening column file\n";
+        return s;
+    }
+
+    struct stat st;
+    size_t map_len = sizeof(column_file_header) + num_data * sizeof(int);
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < map_len) {
+        close(fd);
+        s.code = ERROR;
+        s.error_message = "Corrupt column file\n";
+        return s;
+    }
+
+    void* base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        s.code = ERROR;
+        s.error_message = "Error mapping column file\n";
+        return s;
+    }
+
+    column_file_header* header = (column_file_header*)base;
+    if (header->magic != COLUMN_FILE_MAGIC ||
+            header->version != COLUMN_FILE_VERSION ||
+            header->num_vals != num_data) {
+        munmap(base, map_len);
+        s.code = ERROR;
+        s.error_message = "Corrupt column file\n";
+        return s;
+    }
+
+    free_column_data(col1);
+    col1->map_base = base;
+    col1->map_len = map_len;
+    col1->data = (int*)(header + 1);
+    col1->data_count = num_data;
+    col1->capacity = num_data;
+    col1->dirty = false;
+
+    s.code = OK;
     return s;
 }
 
 status read_column(FILE* f, table** tbl1, column** col1) {
     status s;
 
+    char* saveptr;
     char * line = NULL;
     size_t len = 0;
     ssize_t read = getline(&line, &len, f);
@@ -254,7 +416,7 @@ status read_column(FILE* f, table** tbl1, column** col1) {
         s.error_message = "Error reading data on disk\n";
         return s;
     }
-    s = create_column(*tbl1, strtok(line, "\n"), col1, false);
+    s = create_column(*tbl1, strtok_r(line, "\n", &saveptr), col1, false);
     if (s.code != OK) {
         return s;
     }
@@ -282,6 +444,10 @@ status read_column(FILE* f, table** tbl1, column** col1) {
         type = SORTED;
     } else if (strncmp(line, "b_plus_tree", 11) == 0) {
         type = B_PLUS_TREE;
+    } else if (strncmp(line, "css_tree", 8) == 0) {
+        type = CSS_TREE;
+    } else if (strncmp(line, "cracked", 7) == 0) {
+        type = CRACKED;
     }
 
     read = getline(&line, &len, f);
@@ -290,26 +456,20 @@ status read_column(FILE* f, table** tbl1, column** col1) {
         s.error_message = "Error reading data on disk\n";
         return s;
     }
-    size_t num_data = (size_t) atoi(line);
+    size_t num_data = (size_t) strtoull(line, NULL, 10);
+    free(line);
 
-    for (int i = 0; i < (int)num_data; i++) {
-        read = getline(&line, &len, f);
-        if (read == -1) {
-            s.code = ERROR;
-            s.error_message = "Error reading data on disk\n";
-            return s;
-        }
-        s = col_insert(*col1, atoi(line));
-        if (s.code != OK) {
-            return s;
-        }
+    s = map_column_data(*col1, num_data);
+    if (s.code != OK) {
+        return s;
     }
 
+    // Built on first use, so startup does not touch the data
     if (type != NONE) {
-        s = create_index(*col1, type);
-        if (s.code != OK) {
-            return s;
-        }
+        (*col1)->index = malloc(sizeof(struct column_index));
+        (*col1)->index->type = type;
+        (*col1)->index->index = NULL;
+        pthread_mutex_init(&(*col1)->index->lock, NULL);
     }
 
     s.code = OK;
@@ -319,6 +479,7 @@ status read_column(FILE* f, table** tbl1, column** col1) {
 status read_table(FILE* f, table** tbl1) {
     status s;
 
+    char* saveptr;
     char * line = NULL;
     size_t len = 0;
     ssize_t read = getline(&line, &len, f);
@@ -327,8 +488,8 @@ status read_table(FILE* f, table** tbl1) {
         s.error_message = "Error reading data on disk\n";
         return s;
     }
-    char* temp = strtok(line, "\n");
-    char tbl_name[strlen(temp)];
+    char* temp = strtok_r(line, "\n", &saveptr);
+    char tbl_name[strlen(temp) + 1];
     strcpy(tbl_name, temp);
     read = getline(&line, &len, f);
     if (read == -1) {
@@ -355,9 +516,10 @@ status read_table(FILE* f, table** tbl1) {
     return s;
 }
 
-status read_db(FILE* f) {
+status read_db(FILE* f, uint64_t* checkpoint_lsn) {
     status s;
 
+    char* saveptr;
     char * line = NULL;
     size_t len = 0;
     ssize_t read = getline(&line, &len, f);
@@ -366,11 +528,19 @@ status read_db(FILE* f) {
         s.code = OK;
         return s;
     }
-    s = create_db(strtok(line, "\n"), &global_db);
+    s = create_db(strtok_r(line, "\n", &saveptr), &global_db);
     if (s.code != OK) {
         return s;
     }
 
+    read = getline(&line, &len, f);
+    if (read == -1) {
+        s.code = ERROR;
+        s.error_message = "Error reading data on disk\n";
+        return s;
+    }
+    *checkpoint_lsn = strtoull(line, NULL, 10);
+
     read = getline(&line, &len, f);
     if (read == -1) {
         s.code = ERROR;
@@ -394,23 +564,23 @@ status read_db(FILE* f) {
 status grab_persisted_data() {
     status s;
 
-    FILE* f = fopen("db.txt", "r");
-    
-    // File doesn't exist
-    if (f == NULL) {
-        log_info("db.txt doesn't exist\n");
-        s.code = OK;
-        return s;
-    }
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/%s", DATA_DIR, CATALOG_FILE);
+    FILE* f = fopen(path, "r");
 
-    s = read_db(f);
-    fclose(f);
-    if (s.code != OK) {
-        return s;
+    // Replay the log on top of the last checkpoint, if there is one
+    uint64_t checkpoint_lsn = 0;
+    if (f == NULL) {
+        log_info("%s doesn't exist\n", path);
+    } else {
+        s = read_db(f, &checkpoint_lsn);
+        fclose(f);
+        if (s.code != OK) {
+            return s;
+        }
     }
 
-    s.code = OK;
-    return s;
+    return wal_recover(checkpoint_lsn);
 
 }
 
@@ -419,31 +589,17 @@ void free_result(result* res) {
     free(res);
 }
 
-status free_catalogs() {
-    status s;
-    for(int i=0; i < DEFAULT_NUM_CLIENTS_ALLOWED; i++) {
-        for(int j=0; j < DEFAULT_CATALOG_RESULTS; j++) {
-            if (!(catalogs[i]->names[j])) {
-                break;
-            }
-            free(catalogs[i]->names[j]);
-            free_result(catalogs[i]->results[j]);
+void clear_catalog(catalog* vars) {
+    for(size_t j = 0; j < vars->capacity; j++) {
+        if (vars->entries[j].name) {
+            free(vars->entries[j].name);
+            free_result(vars->entries[j].res);
         }
-        free(catalogs[i]);
     }
-    s.code = OK;
-    return s;
-}
-
-db_operator* init_dbo() {
-    db_operator *dbo = malloc(sizeof(struct db_operator));
-    dbo->columns = NULL;
-    dbo->tables = NULL;
-    dbo->value1 = NULL;
-    dbo->value2 = NULL;
-    dbo->result1 = NULL;
-    dbo->result2 = NULL;
-    return dbo;
+    free(vars->entries);
+    vars->entries = NULL;
+    vars->capacity = 0;
+    vars->var_count = 0;
 }
 
 int binary_search(int* data, int target, int start, int end) {
@@ -451,24 +607,170 @@ int binary_search(int* data, int target, int start, int end) {
     while(start != end) {
         mid = (start+end) >> 1;
         if (data[mid] <= target) {
-            for(; mid < end-1 && data[mid] == data[mid+1]; mid++);
             start = mid + 1;
         } else {
-            for(; mid > start && data[mid-1] == data[mid]; mid--);
             end = mid;
         }
     }
     return start;
 }
 
+int compare_kv_pairs(const void* a, const void* b) {
+    const kv_pair* x = (const kv_pair*)a;
+    const kv_pair* y = (const kv_pair*)b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+typedef struct sort_args {
+    kv_pair* pairs;
+    size_t count;
+} sort_args;
+
+void* sort_pairs_worker(void* arg) {
+    sort_args* args = (sort_args*)arg;
+    qsort(args->pairs, args->count, sizeof(struct kv_pair), compare_kv_pairs);
+    return NULL;
+}
+
+// Merges the sorted runs a[0, na) and b[0, nb) into out.
+void merge_pairs(kv_pair* a, size_t na, kv_pair* b, size_t nb, kv_pair* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (compare_kv_pairs(&b[j], &a[i]) < 0) {
+            out[k++] = b[j++];
+        } else {
+            out[k++] = a[i++];
+        }
+    }
+    memcpy(out + k, a + i, (na - i) * sizeof(struct kv_pair));
+    k += na - i;
+    memcpy(out + k, b + j, (nb - j) * sizeof(struct kv_pair));
+}
+
+// Sorts DEFAULT_NUM_THREADS chunks of pairs in parallel, then merges
+// neighbouring runs until one is left.
+bool parallel_sort_pairs(kv_pair* pairs, size_t num_vals) {
+    size_t num_threads = DEFAULT_NUM_THREADS;
+    size_t chunk = (num_vals + num_threads - 1) / num_threads;
+
+    kv_pair* tmp = malloc(num_vals * sizeof(struct kv_pair));
+    if (!tmp) {
+        return false;
+    }
+
+    pthread_t threads[num_threads];
+    sort_args args[num_threads];
+    bool started[num_threads];
+    size_t bounds[num_threads + 1];
+
+    for(size_t t = 0; t <= num_threads; t++) {
+        bounds[t] = t*chunk < num_vals ? t*chunk : num_vals;
+    }
+    for(size_t t = 0; t < num_threads; t++) {
+        args[t].pairs = pairs + bounds[t];
+        args[t].count = bounds[t+1] - bounds[t];
+
+        // Sort the chunk inline if we can't get another thread
+        started[t] = pthread_create(&threads[t], NULL, sort_pairs_worker, &args[t]) == 0;
+        if (!started[t]) {
+            sort_pairs_worker(&args[t]);
+        }
+    }
+    for(size_t t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+
+    kv_pair* src = pairs;
+    kv_pair* dst = tmp;
+    for(size_t width = 1; width < num_threads; width *= 2) {
+        for(size_t t = 0; t < num_threads; t += 2*width) {
+            size_t lo = bounds[t];
+            size_t mid = bounds[t + width < num_threads ? t + width : num_threads];
+            size_t hi = bounds[t + 2*width < num_threads ? t + 2*width : num_threads];
+            merge_pairs(src + lo, mid - lo, src + mid, hi - mid, dst + lo);
+        }
+        kv_pair* swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != pairs) {
+        memcpy(pairs, src, num_vals * sizeof(struct kv_pair));
+    }
+    free(tmp);
+
+    return true;
+}
+
+// Returns a new array of (keys[i], positions[i]) sorted by key. If positions
+// is NULL, each key's position is its index. The caller frees the array.
+kv_pair* sort_pairs(int* keys, int* positions, size_t num_vals) {
+    kv_pair* pairs = malloc((num_vals ? num_vals : 1) * sizeof(struct kv_pair));
+    if (!pairs) {
+        return NULL;
+    }
+
+    for(size_t i = 0; i < num_vals; i++) {
+        pairs[i].key = keys[i];
+        pairs[i].pos = positions ? positions[i] : (int)i;
+    }
+
+    if (num_vals < PARALLEL_SORT_THRESHOLD || DEFAULT_NUM_THREADS < 2 ||
+            !parallel_sort_pairs(pairs, num_vals)) {
+        qsort(pairs, num_vals, sizeof(struct kv_pair), compare_kv_pairs);
+    }
+
+    return pairs;
+}
+
 int check_data(int data, int lower, int upper) {
     return (int)(lower <= data && data < upper);
 }
 
-tuples* init_tuples() {
-    tuples* tups = malloc(sizeof(struct tuples));
-    tups->payloads = calloc(DEFAULT_NUM_COLS, sizeof(int*));
-    tups->num_cols = 0;
-    tups->num_rows = 0;
-    return tups;
+result* init_result() {
+    result* res = malloc(sizeof(struct result));
+    res->num_tuples = 0;
+    res->payload = NULL;
+    res->type = INT;
+    res->max_size = 0;
+    res->sorted = false;
+    res->source = NULL;
+    res->num_bits = 0;
+    res->distinct = false;
+    return res;
 }
+
+status materialize_positions(result* res) {
+    status s;
+    s.code = OK;
+    if (res->type != BITMAP) {
+        return s;
+    }
+
+    int* positions = malloc((res->num_tuples ? res->num_tuples : 1) * sizeof(int));
+    if (!positions) {
+        s.code = ERROR;
+        s.error_message = "Error allocating positions\n";
+        return s;
+    }
+
+    uint64_t* bits = (uint64_t*)res->payload;
+    size_t j = 0;
+    for(size_t w = 0; w * 64 < res->num_bits; w++) {
+        for(uint64_t word = bits[w]; word; word &= word - 1) {
+            positions[j++] = (int)(w * 64 + __builtin_ctzll(word));
+        }
+    }
+
+    free(res->payload);
+    res->payload = positions;
+    res->type = INT;
+    res->num_bits = 0;
+    return s;
+}
+
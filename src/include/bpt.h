@@ -12,6 +12,16 @@
 
 #define DEFAULT_ORDER 4096
 
+// Fraction of each node filled by bulk loading; the rest is left free for
+// col_insert to add keys without splitting. Override with
+// CFLAGS+="-DBPT_FILL_FACTOR=...".
+#ifndef BPT_FILL_FACTOR
+#define BPT_FILL_FACTOR 0.9
+#endif
+
+// Fan-out of the tree; a leaf's pointers[order - 1] links to the next leaf.
+extern int order;
+
 // TYPES.
 
 typedef struct node {
@@ -32,6 +42,7 @@ void print_tree(node* root);
 // For find
 node* find_leaf(node * root, int key);
 int* find_in_bptree(node* root, int key);
+// Positions of values in [lower, upper), in value order.
 status find_range_bpt(column* col, result* r, int lower, int upper);
 
 // For insert
@@ -47,8 +58,14 @@ status insert_into_parent(node** root, node* left, int key, node* right);
 status insert_into_new_root(node** root, node* left, int key, node* right);
 status start_new_tree(node** root, int key, int* ptr);
 status insert_bpt(node** root, int key, int* value);
-status update_bpt_pointers(node* root, int* pointer);
+status update_bpt_pointers(node* root, int* old_base, int* new_base);
 status build_secondary_bpt_index(column *col);
 
+// For bulk loading
+status bulk_load_bpt(node** root, kv_pair* pairs, size_t num_pairs, int* base);
+void free_node(node* n);
+void free_bpt(node* root);
+void free_bpt_level(node** level, size_t num_nodes);
+
 #endif // BPT_H__
 
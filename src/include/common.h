@@ -17,6 +17,7 @@ typedef enum DataType {
      LONG,
      CHAR,
      LONG_DOUBLE,
+     BITMAP,
      // Others??
 } DataType;
 
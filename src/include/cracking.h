@@ -0,0 +1,48 @@
+#ifndef CRACKING_H__
+#define CRACKING_H__
+
+/*
+* Adaptive indexing by database cracking. A cracked index keeps a copy of the
+* column (the cracker column) that every range select partitions a little
+* further around its bounds, and a cracker index of the boundaries made so
+* far. Repeated selects touch ever smaller pieces and converge to index
+* speed. Inserted values wait in a pending buffer and are rippled into
+* their pieces by the next select.
+*/
+#include "cs165_api.h"
+
+// All cracker values before start are < key, all from start on are >= key.
+typedef struct crack_boundary {
+    int key;
+    size_t start;
+} crack_boundary;
+
+typedef struct cracker {
+    int* vals;
+    int* positions;
+    size_t count;
+    size_t capacity;
+
+    // Cracker index, sorted by key
+    crack_boundary* bounds;
+    size_t num_bounds;
+    size_t bounds_capacity;
+
+    // Inserts not merged into the cracker column yet
+    int* pending_vals;
+    int* pending_positions;
+    size_t num_pending;
+    size_t pending_capacity;
+} cracker;
+
+status build_cracker_index(column* col);
+void free_cracker(cracker* c);
+
+// Queues a value inserted at @pos for the next select.
+status cracker_insert(cracker* c, int val, int pos);
+
+// Cracks on lower and upper and returns the positions of values in
+// [lower, upper).
+status crack_select(column* col, result* r, int lower, int upper);
+
+#endif // CRACKING_H__
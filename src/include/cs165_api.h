@@ -21,21 +21,62 @@ SOFTWARE.
 #define CS165_H
 
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "common.h"
 
 #define DEFAULT_NUM_TABLES 50
 #define DEFAULT_NUM_COLS 500
-#define DEFAULT_NUM_VALS 5000000
+// Columns start with room for DEFAULT_COLUMN_CAPACITY values and double
+// when full, growing by COLUMN_GROWTH_CHUNK values at a time once larger.
+#ifndef DEFAULT_COLUMN_CAPACITY
+#define DEFAULT_COLUMN_CAPACITY 1024
+#endif
+#ifndef COLUMN_GROWTH_CHUNK
+#define COLUMN_GROWTH_CHUNK (1 << 24)
+#endif
 #define DEFAULT_VAR_NAME_LENGTH 10
 #define DEFAULT_NUM_CLIENTS_ALLOWED 10
-#define DEFAULT_CATALOG_RESULTS 2000
+// Slots a client's catalog starts with; it doubles whenever it is half full.
+#ifndef DEFAULT_CATALOG_CAPACITY
+#define DEFAULT_CATALOG_CAPACITY 64
+#endif
+#ifndef DEFAULT_SHARED_SCAN_BUFFER_SIZE
 #define DEFAULT_SHARED_SCAN_BUFFER_SIZE 10
+#endif
+// A multiple of 64, so blocks start on a word of a select's bitmap.
+#define SHARED_SCAN_BLOCK_SIZE 4096
+
+// Persisted data lives in DATA_DIR: a text catalog of the tables and
+// columns, plus one binary file of raw values per column.
+#ifndef DATA_DIR
+#define DATA_DIR "data"
+#endif
+#define CATALOG_FILE "catalog"
 
 #define HASH_THRESHOLD 4096
 #define PAGESIZE 524288
 #define CACHESIZE 24
 
+// Scans over columns with at least PARALLEL_SCAN_THRESHOLD rows, and sorts
+// of at least PARALLEL_SORT_THRESHOLD values, are split into
+// DEFAULT_NUM_THREADS chunks. Override with CFLAGS+="-D...".
+#ifndef DEFAULT_NUM_THREADS
+#define DEFAULT_NUM_THREADS 4
+#endif
+#ifndef PARALLEL_SCAN_THRESHOLD
+#define PARALLEL_SCAN_THRESHOLD 1000000
+#endif
+#ifndef PARALLEL_SORT_THRESHOLD
+#define PARALLEL_SORT_THRESHOLD 100000
+#endif
+
+// Queries from all clients run on a fixed pool of DEFAULT_NUM_WORKERS
+// threads fed by the server's event loop.
+#ifndef DEFAULT_NUM_WORKERS
+#define DEFAULT_NUM_WORKERS 4
+#endif
+
 // Set bool type
 #define bool char
 #define false 0
@@ -50,6 +91,8 @@ typedef enum IndexType {
     NONE,
     SORTED,
     B_PLUS_TREE,
+    CSS_TREE,
+    CRACKED,
 } IndexType;
 
 /**
@@ -57,14 +100,20 @@ typedef enum IndexType {
  * Defines a general column_index structure, which can be used as a sorted
  * index or a b+-tree index.
  * - type, the column index type (see enum index_type)
- * - index, a pointer to the index structure. For SORTED, this points to the
- *       start of the sorted array. For B+Tree, this points to the root node.
+ * - index, a pointer to the index structure. For SORTED, this points to a
+ *       sorted_index. For B+Tree, this points to the root node.
+ *       For CSS_TREE, this points to a css_tree. For CRACKED, this points
+ *       to a cracker.
  *       You will need to cast this from void* to the appropriate type when
  *       working with the index.
+ * - lock, held while the index is built or changed by a read (cracking,
+ *       re-sorting a stale sorted index), since reads of the same column
+ *       run concurrently.
  **/
 typedef struct column_index {
     IndexType type;
     void* index;
+    pthread_mutex_t lock;
 } column_index;
 
 /**
@@ -76,7 +125,17 @@ typedef struct column_index {
  *       name.
  * - data, this is the raw data for the column. Operations on the data should
  *       be persistent.
+ * - capacity, the number of values data has room for. Appends past it
+ *       reallocate data (see col_reserve), so do not hold on to pointers
+ *       into it across inserts.
  * - index, this is an [opt] index built on top of the column's data.
+ *       Indexes of columns read from disk are built on first use.
+ * - dirty, whether the column changed since it was last checkpointed.
+ * - map_base, map_len, the private mapping of the column file that data
+ *       points into for columns read from disk, or NULL once the data lives
+ *       on the heap. Pages are read in as queries touch them, and writes
+ *       to mapped data are copy-on-write; appends move the data to the
+ *       heap first.
  *
  * NOTE: We do not track the column length in the column struct since all
  * columns in a table should share the same length. Instead, this is
@@ -87,7 +146,11 @@ typedef struct column {
     int* data;
     column_index *index;
     size_t data_count;
+    size_t capacity;
     bool leading;
+    bool dirty;
+    void* map_base;
+    size_t map_len;
 } column;
 
 /**
@@ -144,11 +207,28 @@ typedef struct status {
 //     void* vals;
 // } row;
 
+/**
+ * result
+ * An intermediate result held in a client catalog.
+ * - sorted, set when the payload is known to be in non-decreasing order, e.g.
+ *       values fetched in position order from a leading column.
+ * - source, the column the values were fetched from, if any. Joins use it to
+ *       reach the column's index.
+ * - distinct, set when the payload holds positions that never repeat, as
+ *       selects produce. Index nested loop joins can only take those.
+ * - num_bits, for BITMAP results of selects: the payload is ceil(num_bits/64)
+ *       uint64_t words with bit i set if row i qualified, and num_tuples is
+ *       the number of bits set.
+ **/
 typedef struct result {
     size_t num_tuples;
     void *payload;
     DataType type;
     size_t max_size;
+    bool sorted;
+    struct column* source;
+    size_t num_bits;
+    bool distinct;
 } result;
 
 typedef enum Aggr {
@@ -158,6 +238,13 @@ typedef enum Aggr {
     CNT,
 } Aggr;
 
+typedef enum JoinType {
+    JOIN_AUTO,
+    JOIN_HASH,
+    JOIN_SORT_MERGE,
+    JOIN_INDEX_NESTED_LOOP,
+} JoinType;
+
 typedef enum OperatorType {
     CREATE_OP,
     SELECT,
@@ -172,13 +259,27 @@ typedef enum OperatorType {
     ADD,
     SUB,
     SHARED_SCAN,
+    BATCH,
+    LOAD_FILE,
 } OperatorType;
 
+// What a CREATE_OP creates
+typedef enum ObjectType {
+    DB_OBJECT,
+    TABLE_OBJECT,
+    COLUMN_OBJECT,
+    INDEX_OBJECT,
+} ObjectType;
+
+// The vectors of a tuple() query, with @types[j] the type of payloads[j].
+// @from_columns is set if any payload is a column's own data, which other
+// clients may change.
 typedef struct tuples {
     void** payloads;
+    DataType* types;
     size_t num_rows;
     size_t num_cols;
-    DataType type;
+    bool from_columns;
 } tuples;
 
 /**
@@ -238,11 +339,19 @@ typedef struct db_operator {
 
     // This includes several possible fields that may be used in the operation.
     Aggr agg;
+    JoinType join;
 
     // comparators
     int lower;
     int upper;
 
+    // For CREATE_OP: what to create under name1, a new table's column
+    // count, whether a new column is sorted and a new index's type.
+    ObjectType object;
+    size_t num_cols;
+    bool sorted;
+    IndexType index_type;
+
 } db_operator;
 
 typedef enum OpenFlags {
@@ -250,9 +359,20 @@ typedef enum OpenFlags {
     LOAD = 2,
 } OpenFlags;
 
+/**
+ * catalog
+ * A client's variables: an open-addressing hash table from each name to
+ * its result. @capacity is a power of two, or 0 until the first variable
+ * is bound; empty slots have a NULL name.
+ **/
+typedef struct catalog_entry {
+    char* name;
+    result* res;
+} catalog_entry;
+
 typedef struct catalog {
-    char* names[DEFAULT_CATALOG_RESULTS];
-    result* results[DEFAULT_CATALOG_RESULTS];
+    catalog_entry* entries;
+    size_t capacity;
     size_t var_count;
 } catalog;
 
@@ -269,6 +389,20 @@ typedef struct select_queue {
     column* col;
 } select_queue;
 
+/**
+ * session
+ * State of one client connection: the catalog slot holding its variables
+ * and the selects it has queued between batch_queries() and
+ * batch_execute(), one queue per column.
+ **/
+typedef struct session {
+    catalog* vars;
+    int slot;
+    bool batching;
+    select_queue* shared_scans[DEFAULT_NUM_COLS];
+    size_t shared_scan_count;
+} session;
+
 /* OPERATOR API*/
 /**
  * open_db(filename, db, flags)
@@ -391,14 +525,58 @@ status create_column(table *table, const char* name, column** col, bool sorted);
  **/
 status create_index(column* col, IndexType type);
 
+/**
+ * build_index(col)
+ * (Re)builds col->index from the column's current data.
+ **/
+status build_index(column* col);
+
+/**
+ * col_reserve(col, num_vals)
+ * Makes room for at least @num_vals values in @col, moving a column mapped
+ * from disk onto the heap, and rebases any index that points into the old
+ * data.
+ *
+ * free_column_data(col)
+ * Releases the column's data, whether it is mapped or on the heap.
+ **/
+status col_reserve(column* col, size_t num_vals);
+void free_column_data(column* col);
+
 status col_insert(column *col, int data);
-status delete(column *col, int *pos);
-status update(column *col, int *pos, int new_val);
+
+/**
+ * insert_row(tbl, vals)
+ * Appends one row with a value for each column of @tbl.
+ *
+ * update(col, pos, num_pos, new_val)
+ * Sets the values at the @num_pos positions @pos of @col to @new_val.
+ *
+ * delete(tbl, pos, num_pos)
+ * Removes the rows at the @num_pos positions @pos from every column of
+ * @tbl; later rows move up.
+ *
+ * All three mark the columns they change dirty for the next checkpoint.
+ * Positions are checked before anything changes.
+ **/
+status insert_row(table* tbl, int* vals);
+status update(column *col, int *pos, size_t num_pos, int new_val);
+status delete(table* tbl, int *pos, size_t num_pos);
+
+/**
+ * invalidate_index(col)
+ * Drops the built index of @col after its data changed in a way the index
+ * cannot follow; it is rebuilt on the next index scan.
+ **/
+void invalidate_index(column* col);
 status select_data(db_operator* query, result **r);
 status index_scan(int lower, int upper, column *col, result **r);
 status col_scan(int lower, int upper, column *col, result **r);
+status col_scan_parallel(db_operator* query, result **r);
 status vec_scan(db_operator* query, result** r);
+status shared_scan(select_queue* q);
 status fetch(column *col, int* indices, size_t val_count, result **r);
+status fetch_bitmap(column *col, result* pos, result **r);
 
 status add_col(int* vals1, int* vals2, size_t num_vals, result** r);
 status sub_col(int* vals1, int* vals2, size_t num_vals, result** r);
@@ -0,0 +1,53 @@
+#ifndef CSSTREE_H__
+#define CSSTREE_H__
+
+/*
+* Cache-sensitive search tree (CSS-tree) for read-mostly indexes.
+* Inner nodes are exactly one cache line of CSS_NODE_KEYS inline keys with no
+* child pointers: children of node i on one level are nodes
+* i*CSS_FANOUT .. i*CSS_FANOUT + CSS_NODE_KEYS on the next, so a whole level
+* is a single array. Key j of a node is the largest key under child j, and
+* the keys in a node are compared against the search key all at once with
+* SSE2 when it is available. Inserted values wait in a pending buffer that
+* selects scan, and are merged into a rebuilt tree once CSS_MERGE_THRESHOLD
+* of them have gathered.
+*/
+#include "cs165_api.h"
+#include "helpers.h"
+
+#define CSS_NODE_KEYS 16
+#define CSS_FANOUT (CSS_NODE_KEYS + 1)
+#ifndef CSS_MERGE_THRESHOLD
+#define CSS_MERGE_THRESHOLD 1024
+#endif
+
+typedef struct css_tree {
+    int* keys;          // sorted keys, padded with INT_MAX to whole nodes
+    int* positions;     // column position of each key
+    size_t num_keys;
+    int** levels;       // inner levels, root first
+    size_t* level_nodes;
+    int num_levels;
+
+    // Inserts not merged into the tree yet
+    int* pending_vals;
+    int* pending_positions;
+    size_t num_pending;
+} css_tree;
+
+status build_css_tree(css_tree** tree, kv_pair* pairs, size_t num_pairs);
+status build_css_index(column* col);
+void free_css_tree(css_tree* tree);
+
+// Queues a value inserted at @pos, merging the queue into a new tree in
+// *tree once it is full.
+status css_insert(css_tree** tree, int val, int pos);
+
+// Index of the first key >= key, or num_keys if there is none.
+size_t css_lower_bound(css_tree* tree, int key);
+
+// Positions of values in [lower, upper): those in the tree in value order,
+// then pending inserts in insertion order.
+status find_range_css(column* col, result* r, int lower, int upper);
+
+#endif // CSSTREE_H__
@@ -13,7 +13,7 @@
 
 // Currently we have 4 DSL commands to parse.
 // TODO(USER): you will need to increase this to track the commands you support.
-#define NUM_DSL_COMMANDS (20)
+#define NUM_DSL_COMMANDS (24)
 
 // This helps group similar DSL commands together.
 // For example, some queries can be parsed together:
@@ -43,38 +43,25 @@ typedef enum DSLGroup {
     SUB_RESULT,
     CNT_RESULT,
     SHUTDOWN_SERVER,
-    CREATE_BTREE,
+    CREATE_INDEX,
+    BATCH_QUERIES,
+    BATCH_EXECUTE,
+    HASH_JOIN,
+    PLANNED_JOIN,
+    RELATIONAL_UPDATE,
+    RELATIONAL_DELETE,
 } DSLGroup;
 
 // A dsl is defined as the DSL listed on the project website.
 // We use this to track the relevant string to parse, and its group.
+// @name is how the command starts once any "<var>=" is stripped; the parser
+// picks the command by it and then reads the arguments by hand.
 typedef struct dsl {
-    const char* c;
+    const char* name;
     DSLGroup g;
 } dsl;
 
 // This returns an array of all the DSL commands that you can match with.
 dsl** dsl_commands_init(void);
 
-// We define these in the dsl.c file.
-// TODO(USER) Add more extern strings for new commands
-extern const char* create_db_command;
-extern const char* create_table_command;
-extern const char* create_col_command_sorted;
-extern const char* create_col_command_unsorted;
-extern const char* relational_insert_command;
-extern const char* bulk_load_command;
-extern const char* select_type1_column_command;
-extern const char* select_type2_column_command;
-extern const char* project_column_command;
-extern const char* project_column_command;
-extern const char* tuple_result_command;
-extern const char* add_result_command;
-extern const char* sub_result_command;
-extern const char* cnt_result_command;
-extern const char* shutdown_server_command;
-extern const char* create_btree_command;
-extern const char* hashjoin_command;
-extern const char* shared_scan_command;
-
 #endif // DSL_H__
@@ -8,27 +8,50 @@
 #include "cs165_api.h"
 
 // PARSER FUNCTIONS
-int find_table(char* tbl_name);
-int find_column(table* tbl, char* col_name);
-int find_table_from_col_name(char* col_name);
-int create_lower_bound(char* val);
-int create_upper_bound(char* val);
-result* find_result(char* name);
-status prepare_result(char* var_name, result** r);
-status relational_insert(int tbl_idx, char* vals, db_operator* op);
+// Names are looked up by their first @len characters, so they can be
+// passed straight from the query text.
+int find_table(const char* tbl_name, size_t len);
+int find_column(table* tbl, const char* col_name, size_t len);
+int find_table_from_col_name(const char* col_name, size_t len);
+result* find_result(const char* name, size_t len);
+
+// Binds @r to the variable @name in the current client's catalog, which
+// keeps its own copy of @name and frees any result @name had before.
+status bind_result(const char* name, result* r);
 
 // SERVER FUNCTIONS
 catalog** init_catalogs();
 status persist_data();
+void free_db();
 status grab_persisted_data();
 void free_result(result* res);
-status free_catalogs();
-db_operator* init_dbo();
-tuples* init_tuples();
+void clear_catalog(catalog* vars);
+
+// The session of the client whose request this thread is running
+extern __thread session* current_session;
+result* init_result();
+
+/**
+ * materialize_positions(res)
+ * Turns a BITMAP result into the INT list of the positions it holds, for
+ * operators that only take position lists. Other results are left as they
+ * are.
+ **/
+status materialize_positions(result* res);
 
 // INDEX FUNCTIONS
 int binary_search(int* data, int target, int start, int end);
 
+// SORT FUNCTIONS
+// A value and the position it came from, sorted by value then position.
+typedef struct kv_pair {
+    int key;
+    int pos;
+} kv_pair;
+
+int compare_kv_pairs(const void* a, const void* b);
+kv_pair* sort_pairs(int* keys, int* positions, size_t num_vals);
+
 // SELECT FUNCTIONS
 int check_data(int data, int lower, int upper);
 
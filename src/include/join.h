@@ -0,0 +1,56 @@
+#ifndef JOIN_H__
+#define JOIN_H__
+
+#include "cs165_api.h"
+
+// Radix join sizing. Partitioning stops once the build side of a partition
+// fits in PAGESIZE bytes, counting RADIX_TUPLE_BYTES per build tuple (value,
+// position and hash table slots). Each pass fans out to at most
+// 2^RADIX_BITS_PER_PASS partitions to stay within the TLB, at most two passes
+// are made, and CACHESIZE caps the total number of radix bits.
+#define RADIX_TUPLE_BYTES 16
+#define RADIX_BITS_PER_PASS 8
+
+// Minimum size ratio between the larger and smaller join input before
+// join_data probes a B+tree instead of hashing.
+#define INLJ_RATIO 32
+
+/**
+ * Joins operate on the (value, position) vector pairs produced by fetch() and
+ * select(). Each join emits two aligned position vectors: the i-th entries of
+ * r1 and r2 are the positions of a matching pair from the left and right
+ * inputs respectively.
+ **/
+
+// Hash join. Builds on the smaller input and probes with the larger. Inputs
+// that both have fewer than HASH_THRESHOLD values use a nested loop join
+// instead, since building a table does not pay off for them.
+status hash_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2);
+
+// Radix-partitioned hash join. Both inputs are partitioned on the low bits of
+// a hash of the value in one or two passes, then matching partitions are
+// joined with small cache-resident hash tables across DEFAULT_NUM_THREADS
+// threads. hash_join switches to it once the build side outgrows PAGESIZE.
+status radix_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2);
+
+// Sort-merge join. An input whose values are already sorted (see
+// result.sorted) is merged as is, otherwise it is sorted first.
+status sort_merge_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2);
+
+// Index nested loop join. Probes the B+tree of the column the right input was
+// fetched from (vals2->source) once for each left value. pos2 must not repeat
+// a position (see result.distinct).
+status index_nested_loop_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2);
+
+// Picks a join algorithm from the input sizes and properties:
+// - index nested loop when one side is at most 1/INLJ_RATIO the size of
+//       the other, the larger side's column has a B+tree and its positions
+//       are distinct,
+// - sort-merge when both sides are already sorted,
+// - hash join otherwise.
+status join_data(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2);
+
+// Nested loop join, used below HASH_THRESHOLD.
+status nested_loop_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2);
+
+#endif // JOIN_H__
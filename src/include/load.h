@@ -0,0 +1,31 @@
+#ifndef LOAD_H__
+#define LOAD_H__
+
+#include "cs165_api.h"
+
+// Load files of at least PARALLEL_LOAD_THRESHOLD bytes are split into
+// DEFAULT_NUM_THREADS chunks and parsed in parallel.
+#ifndef PARALLEL_LOAD_THRESHOLD
+#define PARALLEL_LOAD_THRESHOLD (1 << 20)
+#endif
+
+/**
+ * load_file(path, readable)
+ * Appends the rows of the CSV file at @path to the table its header line
+ * names, one fully qualified column name per field, and rebuilds the
+ * table's indexes. Nothing is appended unless every row parses.
+ * *readable is set to false if the server cannot read @path at all, in
+ * which case the client has to send the rows itself.
+ **/
+status load_file(const char* path, bool* readable);
+
+/**
+ * load_batches(header, batches, len)
+ * Appends rows a client sent in binary batches to the table the CSV
+ * @header line names. Each batch in @batches is its size_t row and
+ * column counts followed by that many ints for each column, in the order
+ * of @header.
+ **/
+status load_batches(const char* header, const char* batches, size_t len);
+
+#endif // LOAD_H__
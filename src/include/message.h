@@ -1,6 +1,8 @@
 #ifndef MESSAGE_H__
 #define MESSAGE_H__
 
+#include <stdint.h>
+
 #include "common.h"
 
 // mesage_status defines the status of the previous request.
@@ -12,14 +14,18 @@ typedef enum message_status {
     LOAD_REQUEST,
     LOAD_DONE,
     SHUTDOWN_CLIENT,
+    LOAD_FROM_CLIENT,
+    LOAD_BATCH,
 } message_status;
 
 // message is a single packet of information sent between client/server.
 // message_status: defines the status of the message.
+// request_id: the query the message belongs to, echoed in its replies.
 // length: defines the length of the string message to be sent.
 // payload: defines the payload of the message.
 typedef struct message {
     message_status status;
+    size_t request_id;
     int length;
     char* payload;
     DataType type;
@@ -27,4 +33,16 @@ typedef struct message {
     size_t num_cols;
 } message;
 
+// wire_header is how a message's header travels on the socket: fixed-width
+// fields in a fixed order, with no pointer and no padding. Its payload, of
+// @length bytes, follows it.
+typedef struct wire_header {
+    uint32_t status;
+    uint32_t type;
+    uint64_t request_id;
+    uint64_t length;
+    uint64_t num_rows;
+    uint64_t num_cols;
+} wire_header;
+
 #endif
@@ -5,12 +5,32 @@
 #include "dsl.h"
 #include "utils.h"
 
-// This parses the command string and then update the db_operator if it requires
-// a specific query plan to be executed.
-// This can automatically run jobs that don't require a query plan,
-// (e.g., create_db, create_tbl, create_col);
+// Bytes of scratch memory a single query may parse into.
+#ifndef PARSE_SCRATCH_SIZE
+#define PARSE_SCRATCH_SIZE 16384
+#endif
+
+/**
+ * parse_scratch
+ * Per-request memory the parser carves names, values, tuples and error
+ * messages out of, so parsing never touches the heap. Everything a
+ * db_operator points to lives here and is only valid until the next query
+ * is parsed into the same scratch.
+ **/
+typedef struct parse_scratch {
+    union {
+        char bytes[PARSE_SCRATCH_SIZE];
+        long double align;
+    } data;
+    size_t used;
+} parse_scratch;
+
+// This parses the command string and fills in the db_operator with the query
+// plan to be executed, without changing the db. Errors name the column of
+// the query they were found at.
 //
-// Usage: parse_command_string(input_query, commands, operator);
-status parse_command_string(char* str, dsl** commands, db_operator* op);
+// Usage: parse_command_string(input_query, commands, operator, scratch);
+status parse_command_string(const char* str, dsl** commands, db_operator* op,
+    parse_scratch* mem);
 
 #endif // PARSER_H__
@@ -0,0 +1,66 @@
+#ifndef SCAN_H__
+#define SCAN_H__
+
+/*
+* Select kernels. Each one compares a run of values against [lower, upper)
+* and compacts the positions of the qualifying ones, or sets their bits in
+* a bitmap, without branching on the data. Wide kernels compare 8 (AVX2)
+* or 16 (AVX-512) values at a time; the widest one the CPU supports is
+* picked the first time a select runs, with a scalar loop everywhere else.
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+// Column selects sample SELECT_SAMPLE_SIZE values. If more than 1 in
+// BITMAP_SELECTIVITY of them qualify, a bitmap of one bit per row is
+// smaller than a list of int positions and the select produces that.
+#ifndef SELECT_SAMPLE_SIZE
+#define SELECT_SAMPLE_SIZE 1024
+#endif
+#ifndef BITMAP_SELECTIVITY
+#define BITMAP_SELECTIVITY 32
+#endif
+
+/**
+ * select_kernel(data, pos, n, lower, upper, base, out)
+ * Writes pos[i], or base + i if @pos is NULL, for every i < @n with
+ * lower <= data[i] < upper to @out, in order, and returns how many there
+ * were. @out needs room for @n values, which it may write past the count.
+ **/
+typedef size_t (*select_kernel)(const int* data, const int* pos, size_t n,
+    int lower, int upper, size_t base, int* out);
+
+/**
+ * bitmap_kernel(data, n, lower, upper, bits)
+ * Sets bit i of @bits for every i < @n with lower <= data[i] < upper and
+ * clears the others, writing whole 64-bit words, and returns how many bits
+ * were set.
+ **/
+typedef size_t (*bitmap_kernel)(const int* data, size_t n, int lower, int upper,
+    uint64_t* bits);
+
+// Runs the select kernel chosen for this CPU.
+size_t select_range(const int* data, const int* pos, size_t n,
+    int lower, int upper, size_t base, int* out);
+
+// Runs the bitmap kernel chosen for this CPU.
+size_t select_bitmap(const int* data, size_t n, int lower, int upper, uint64_t* bits);
+
+// Whether a sample of @data suggests selecting [lower, upper) from it
+// should produce a bitmap rather than positions.
+int select_prefers_bitmap(const int* data, size_t n, int lower, int upper);
+
+// The name of the kernel select_range runs.
+const char* select_kernel_name();
+
+// The kernels called @name ("scalar", "avx2" or "avx512"), or NULL if
+// this CPU cannot run them.
+select_kernel find_select_kernel(const char* name);
+bitmap_kernel find_bitmap_kernel(const char* name);
+
+size_t select_range_scalar(const int* data, const int* pos, size_t n,
+    int lower, int upper, size_t base, int* out);
+size_t select_bitmap_scalar(const int* data, size_t n, int lower, int upper,
+    uint64_t* bits);
+
+#endif // SCAN_H__
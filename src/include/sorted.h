@@ -0,0 +1,27 @@
+#ifndef SORTED_H__
+#define SORTED_H__
+
+/*
+* Sorted index: a secondary sorted projection of a column, stored as the
+* column values in sorted order next to the position each one came from.
+* A range select is two binary searches and returns a contiguous slice of
+* the positions. Inserts only mark the projection stale; index_scan re-sorts
+* it on the next select, which suits read-mostly columns.
+*/
+#include "cs165_api.h"
+#include "helpers.h"
+
+typedef struct sorted_index {
+    int* vals;
+    int* positions;
+    size_t count;
+    bool stale;
+} sorted_index;
+
+status build_sorted_index(column* col);
+void free_sorted_index(sorted_index* idx);
+
+// Positions of values in [lower, upper), in value order.
+status find_range_sorted(column* col, result* r, int lower, int upper);
+
+#endif // SORTED_H__
@@ -9,6 +9,9 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/types.h>
+
+#include "message.h"
 
 // cs165_log(out, format, ...)
 // Writes the string from @format to the @out pointer, extendable for
@@ -33,4 +36,28 @@ void log_err(const char *format, ...);
 // Usage: log_info("Command received: %s", command_string);
 void log_info(const char *format, ...);
 
+// read_fully(fd, buf, len), write_fully(fd, buf, len)
+// Like read and write, but retry short transfers and EINTR until all @len
+// bytes are done. Returns @len, or -1 on error or a premature end of file.
+ssize_t read_fully(int fd, void* buf, size_t len);
+ssize_t write_fully(int fd, const void* buf, size_t len);
+
+// message_to_wire(m, wire), wire_to_message(wire, m)
+// Convert between a message and its header on the socket. The payload
+// pointer is not part of the header; @m's is set to NULL. Returns 0, or -1
+// for a header whose length a message cannot hold.
+void message_to_wire(const message* m, wire_header* wire);
+int wire_to_message(const wire_header* wire, message* m);
+
+// send_frame(fd, header, payload), recv_header(fd, header)
+// Write @header as a wire header followed by its @header->length bytes of
+// @payload, and read such a header back. Both return 0, or -1 on an error,
+// a premature end of file or a malformed header.
+int send_frame(int fd, const message* header, const void* payload);
+int recv_header(int fd, message* header);
+
+// type_width(type)
+// The bytes one value of @type takes in a result or on the wire.
+size_t type_width(DataType type);
+
 #endif /* __UTILS_H__ */
@@ -0,0 +1,60 @@
+#ifndef WAL_H__
+#define WAL_H__
+
+/*
+* Write-ahead log of row changes. Inserts, updates and deletes are applied
+* in memory and appended to DATA_DIR/WAL_FILE; wal_commit makes everything
+* appended so far durable with one fdatasync, and the server commits before
+* it replies, so concurrent changes share a sync (group commit). A
+* checkpoint (persist_data) writes the dirty columns and a catalog stamped
+* with the last logged LSN, after which the log is truncated. Recovery
+* replays the records past the catalog's LSN.
+*/
+#include <stdint.h>
+#include "cs165_api.h"
+
+#define WAL_FILE "wal"
+
+// Appended records are buffered up to WAL_BUFFER_SIZE bytes between writes.
+#ifndef WAL_BUFFER_SIZE
+#define WAL_BUFFER_SIZE (1 << 20)
+#endif
+// A log larger than this is folded into a checkpoint after the next commit.
+#ifndef WAL_CHECKPOINT_SIZE
+#define WAL_CHECKPOINT_SIZE (64 << 20)
+#endif
+// Set to 0 to skip fdatasync on commit, trading durability for speed.
+#ifndef WAL_SYNC
+#define WAL_SYNC 1
+#endif
+
+// Each record is this header followed by num_vals ints: the row for an
+// INSERT, the new value and then the positions for an UPDATE, and the
+// positions for a DELETE.
+typedef struct wal_record {
+    uint64_t lsn;
+    uint32_t type;
+    uint32_t table;
+    uint32_t column;
+    uint32_t num_vals;
+    uint32_t checksum;
+    uint32_t pad;
+} wal_record;
+
+// Replays the records after @checkpoint_lsn and opens the log for appending.
+status wal_recover(uint64_t checkpoint_lsn);
+
+status wal_log_insert(size_t tbl_idx, int* vals, size_t num_vals);
+status wal_log_update(size_t tbl_idx, size_t col_idx, int* pos, size_t num_pos, int new_val);
+status wal_log_delete(size_t tbl_idx, int* pos, size_t num_pos);
+
+status wal_commit();
+bool wal_needs_checkpoint();
+
+// LSN of the last logged record
+uint64_t wal_last_lsn();
+
+// Empties the log once a checkpoint covers it.
+status wal_truncate();
+
+#endif // WAL_H__
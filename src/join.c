@@ -0,0 +1,702 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <limits.h>
+#include "join.h"
+#include "bpt.h"
+
+// Aligned output pairs of a join, grown as matches are found.
+typedef struct join_output {
+    int* left;
+    int* right;
+    size_t count;
+    size_t capacity;
+} join_output;
+
+status init_join_output(join_output* out, size_t capacity) {
+    status s;
+
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    out->left = malloc(capacity * sizeof(int));
+    out->right = malloc(capacity * sizeof(int));
+    out->count = 0;
+    out->capacity = capacity;
+
+    if (!out->left || !out->right) {
+        free(out->left);
+        free(out->right);
+        out->left = NULL;
+        out->right = NULL;
+        out->count = 0;
+        s.code = ERROR;
+        s.error_message = "Join output allocation failed\n";
+        return s;
+    }
+
+    s.code = OK;
+    return s;
+}
+
+status append_join_output(join_output* out, int left, int right) {
+    status s;
+
+    if (out->count == out->capacity) {
+        size_t capacity = out->capacity * 2;
+        int* new_left = realloc(out->left, capacity * sizeof(int));
+        if (!new_left) {
+            s.code = ERROR;
+            s.error_message = "Join output allocation failed\n";
+            return s;
+        }
+        out->left = new_left;
+        int* new_right = realloc(out->right, capacity * sizeof(int));
+        if (!new_right) {
+            s.code = ERROR;
+            s.error_message = "Join output allocation failed\n";
+            return s;
+        }
+        out->right = new_right;
+        out->capacity = capacity;
+    }
+
+    out->left[out->count] = left;
+    out->right[out->count] = right;
+    out->count++;
+
+    s.code = OK;
+    return s;
+}
+
+// Hands the output arrays over to the two result vectors.
+void publish_join_output(join_output* out, result** r1, result** r2) {
+    (*r1)->payload = out->left;
+    (*r1)->num_tuples = out->count;
+    (*r1)->type = INT;
+
+    (*r2)->payload = out->right;
+    (*r2)->num_tuples = out->count;
+    (*r2)->type = INT;
+}
+
+status check_join_inputs(result* vals1, result* pos1, result* vals2, result* pos2) {
+    status s;
+
+    if (vals1->type != INT || pos1->type != INT || vals2->type != INT || pos2->type != INT) {
+        s.code = ERROR;
+        s.error_message = "Join inputs must be int vectors\n";
+        return s;
+    }
+
+    if (vals1->num_tuples != pos1->num_tuples || vals2->num_tuples != pos2->num_tuples) {
+        s.code = ERROR;
+        s.error_message = "Join values and positions must have same length\n";
+        return s;
+    }
+
+    s.code = OK;
+    return s;
+}
+
+status nested_loop_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2) {
+    status s = check_join_inputs(vals1, pos1, vals2, pos2);
+    if (s.code != OK) {
+        return s;
+    }
+
+    int* v1 = (int*)vals1->payload;
+    int* p1 = (int*)pos1->payload;
+    int* v2 = (int*)vals2->payload;
+    int* p2 = (int*)pos2->payload;
+
+    join_output out;
+    s = init_join_output(&out, vals1->num_tuples);
+    if (s.code != OK) {
+        return s;
+    }
+
+    for(size_t i = 0; i < vals1->num_tuples; i++) {
+        for(size_t j = 0; j < vals2->num_tuples; j++) {
+            if (v1[i] == v2[j]) {
+                s = append_join_output(&out, p1[i], p2[j]);
+                if (s.code != OK) {
+                    free(out.left);
+                    free(out.right);
+                    return s;
+                }
+            }
+        }
+    }
+
+    publish_join_output(&out, r1, r2);
+
+    s.code = OK;
+    return s;
+}
+
+// Multiplicative hashing; keeps the top bits, which mix best.
+size_t hash_int(int key, int bits) {
+    return (size_t)(((uint32_t)key * 2654435761u) >> (32 - bits));
+}
+
+// Murmur3 finaliser. Radix partitioning uses its low bits so they are
+// independent of the top bits hash_int uses inside a partition.
+uint32_t radix_hash(int key) {
+    uint32_t h = (uint32_t)key;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+// One side of a join: values and the positions they came from.
+typedef struct join_input {
+    int* vals;
+    int* pos;
+    size_t count;
+} join_input;
+
+// Builds a chained hash table on @build, probes it with @probe and appends
+// the matches to @out as (left, right) pairs.
+status hash_join_into(join_input* build, join_input* probe, bool build_left, join_output* out) {
+    status s;
+
+    // Chained table: heads[bucket] is the first build row in the bucket and
+    // next[row] links rows with the same bucket; -1 ends a chain.
+    int bits = 1;
+    while (((size_t)1 << bits) < build->count && bits < 31) {
+        bits++;
+    }
+    size_t num_buckets = (size_t)1 << bits;
+
+    int* heads = malloc(num_buckets * sizeof(int));
+    int* next = malloc((build->count ? build->count : 1) * sizeof(int));
+    if (!heads || !next) {
+        free(heads);
+        free(next);
+        s.code = ERROR;
+        s.error_message = "Hash table allocation failed\n";
+        return s;
+    }
+    memset(heads, -1, num_buckets * sizeof(int));
+
+    for(size_t i = 0; i < build->count; i++) {
+        size_t bucket = hash_int(build->vals[i], bits);
+        next[i] = heads[bucket];
+        heads[bucket] = i;
+    }
+
+    s.code = OK;
+    for(size_t i = 0; i < probe->count && s.code == OK; i++) {
+        int key = probe->vals[i];
+        for(int e = heads[hash_int(key, bits)]; e != -1; e = next[e]) {
+            if (build->vals[e] != key) {
+                continue;
+            }
+            if (build_left) {
+                s = append_join_output(out, build->pos[e], probe->pos[i]);
+            } else {
+                s = append_join_output(out, probe->pos[i], build->pos[e]);
+            }
+            if (s.code != OK) {
+                break;
+            }
+        }
+    }
+
+    free(heads);
+    free(next);
+    return s;
+}
+
+// Picks the smaller input as the build side.
+bool split_join_inputs(result* vals1, result* pos1, result* vals2, result* pos2, join_input* build, join_input* probe) {
+    bool build_left = vals1->num_tuples <= vals2->num_tuples;
+
+    build->vals = (int*)(build_left ? vals1 : vals2)->payload;
+    build->pos = (int*)(build_left ? pos1 : pos2)->payload;
+    build->count = build_left ? vals1->num_tuples : vals2->num_tuples;
+    probe->vals = (int*)(build_left ? vals2 : vals1)->payload;
+    probe->pos = (int*)(build_left ? pos2 : pos1)->payload;
+    probe->count = build_left ? vals2->num_tuples : vals1->num_tuples;
+
+    return build_left;
+}
+
+status hash_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2) {
+    status s = check_join_inputs(vals1, pos1, vals2, pos2);
+    if (s.code != OK) {
+        return s;
+    }
+
+    // A nested loop's cost is the product of the sizes, so it only pays off
+    // when both sides are small
+    size_t smaller = vals1->num_tuples < vals2->num_tuples ? vals1->num_tuples : vals2->num_tuples;
+    size_t larger = vals1->num_tuples < vals2->num_tuples ? vals2->num_tuples : vals1->num_tuples;
+    if (larger < HASH_THRESHOLD) {
+        return nested_loop_join(vals1, pos1, vals2, pos2, r1, r2);
+    }
+    if (smaller * RADIX_TUPLE_BYTES > PAGESIZE) {
+        return radix_join(vals1, pos1, vals2, pos2, r1, r2);
+    }
+
+    // Build on the smaller side. Matches are always emitted as (left, right)
+    // so the outputs line up with the caller's argument order.
+    join_input build, probe;
+    bool build_left = split_join_inputs(vals1, pos1, vals2, pos2, &build, &probe);
+
+    join_output out;
+    s = init_join_output(&out, probe.count);
+    if (s.code != OK) {
+        return s;
+    }
+
+    s = hash_join_into(&build, &probe, build_left, &out);
+    if (s.code != OK) {
+        free(out.left);
+        free(out.right);
+        return s;
+    }
+
+    publish_join_output(&out, r1, r2);
+
+    s.code = OK;
+    return s;
+}
+
+// Scatters in[from, to) into out[from, to) by radix_hash bits
+// [shift, shift + bits). offsets receives the 2^bits + 1 partition bounds,
+// relative to the start of the whole array.
+void radix_partition(join_input* in, join_input* out, size_t from, size_t to, int shift, int bits, size_t* offsets) {
+    size_t fanout = (size_t)1 << bits;
+    uint32_t mask = (uint32_t)fanout - 1;
+
+    memset(offsets, 0, (fanout + 1) * sizeof(size_t));
+    for(size_t i = from; i < to; i++) {
+        offsets[((radix_hash(in->vals[i]) >> shift) & mask) + 1]++;
+    }
+
+    offsets[0] = from;
+    for(size_t p = 1; p <= fanout; p++) {
+        offsets[p] += offsets[p - 1];
+    }
+
+    size_t cursor[fanout];
+    memcpy(cursor, offsets, fanout * sizeof(size_t));
+    for(size_t i = from; i < to; i++) {
+        size_t p = (radix_hash(in->vals[i]) >> shift) & mask;
+        out->vals[cursor[p]] = in->vals[i];
+        out->pos[cursor[p]] = in->pos[i];
+        cursor[p]++;
+    }
+}
+
+// Partitions @in on 2^(bits1 + bits2) partitions. The first pass splits on
+// the high group of bits, the optional second pass refines each of those
+// partitions on the low group. The partitioned copy ends up in @out and its
+// bounds in @offsets; @tmp is scratch space of the same size.
+void radix_partition_passes(join_input* in, join_input* tmp, join_input* out, int bits1, int bits2, size_t* offsets) {
+    if (bits2 == 0) {
+        radix_partition(in, out, 0, in->count, 0, bits1, offsets);
+        return;
+    }
+
+    size_t fanout1 = (size_t)1 << bits1;
+    size_t fanout2 = (size_t)1 << bits2;
+    size_t first[fanout1 + 1];
+    radix_partition(in, tmp, 0, in->count, bits2, bits1, first);
+
+    for(size_t p = 0; p < fanout1; p++) {
+        radix_partition(tmp, out, first[p], first[p + 1], 0, bits2, offsets + p*fanout2);
+    }
+}
+
+status alloc_join_input(join_input* in, size_t count) {
+    status s;
+
+    in->count = count;
+    in->vals = malloc((count ? count : 1) * sizeof(int));
+    in->pos = malloc((count ? count : 1) * sizeof(int));
+    if (!in->vals || !in->pos) {
+        free(in->vals);
+        free(in->pos);
+        s.code = ERROR;
+        s.error_message = "Radix partition allocation failed\n";
+        return s;
+    }
+
+    s.code = OK;
+    return s;
+}
+
+void free_join_input(join_input* in) {
+    free(in->vals);
+    free(in->pos);
+}
+
+// Work shared by the radix join threads. Thread t joins partitions
+// t, t + num_threads, ... into outputs[t].
+typedef struct radix_join_args {
+    join_input* build;
+    join_input* probe;
+    size_t* build_offsets;
+    size_t* probe_offsets;
+    size_t num_partitions;
+    size_t thread_id;
+    size_t num_threads;
+    bool build_left;
+    join_output output;
+    status s;
+} radix_join_args;
+
+void* radix_join_worker(void* arg) {
+    radix_join_args* args = (radix_join_args*)arg;
+
+    args->s = init_join_output(&(args->output), HASH_THRESHOLD);
+    for(size_t p = args->thread_id; p < args->num_partitions && args->s.code == OK; p += args->num_threads) {
+        join_input build, probe;
+        build.vals = args->build->vals + args->build_offsets[p];
+        build.pos = args->build->pos + args->build_offsets[p];
+        build.count = args->build_offsets[p + 1] - args->build_offsets[p];
+        probe.vals = args->probe->vals + args->probe_offsets[p];
+        probe.pos = args->probe->pos + args->probe_offsets[p];
+        probe.count = args->probe_offsets[p + 1] - args->probe_offsets[p];
+
+        if (build.count == 0 || probe.count == 0) {
+            continue;
+        }
+        args->s = hash_join_into(&build, &probe, args->build_left, &(args->output));
+    }
+
+    return NULL;
+}
+
+status radix_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2) {
+    status s = check_join_inputs(vals1, pos1, vals2, pos2);
+    if (s.code != OK) {
+        return s;
+    }
+
+    join_input build, probe;
+    bool build_left = split_join_inputs(vals1, pos1, vals2, pos2, &build, &probe);
+
+    // Enough bits that a build partition fits in PAGESIZE bytes
+    int max_bits = CACHESIZE < 2*RADIX_BITS_PER_PASS ? CACHESIZE : 2*RADIX_BITS_PER_PASS;
+    int bits = 0;
+    while (bits < max_bits && (build.count >> bits) * RADIX_TUPLE_BYTES > PAGESIZE) {
+        bits++;
+    }
+    int bits1 = bits < RADIX_BITS_PER_PASS ? bits : RADIX_BITS_PER_PASS;
+    int bits2 = bits - bits1;
+    size_t num_partitions = (size_t)1 << bits;
+
+    join_input build_parts, probe_parts, tmp;
+    size_t* build_offsets = malloc((num_partitions + 1) * sizeof(size_t));
+    size_t* probe_offsets = malloc((num_partitions + 1) * sizeof(size_t));
+    if (!build_offsets || !probe_offsets) {
+        free(build_offsets);
+        free(probe_offsets);
+        s.code = ERROR;
+        s.error_message = "Radix partition allocation failed\n";
+        return s;
+    }
+
+    s = alloc_join_input(&build_parts, build.count);
+    if (s.code == OK) {
+        s = alloc_join_input(&probe_parts, probe.count);
+        if (s.code != OK) {
+            free_join_input(&build_parts);
+        }
+    }
+    if (s.code == OK && bits2 > 0) {
+        s = alloc_join_input(&tmp, probe.count);
+        if (s.code != OK) {
+            free_join_input(&build_parts);
+            free_join_input(&probe_parts);
+        }
+    }
+    if (s.code != OK) {
+        free(build_offsets);
+        free(probe_offsets);
+        return s;
+    }
+
+    radix_partition_passes(&build, &tmp, &build_parts, bits1, bits2, build_offsets);
+    radix_partition_passes(&probe, &tmp, &probe_parts, bits1, bits2, probe_offsets);
+    if (bits2 > 0) {
+        free_join_input(&tmp);
+    }
+
+    size_t num_threads = DEFAULT_NUM_THREADS;
+    pthread_t threads[num_threads];
+    radix_join_args args[num_threads];
+    bool started[num_threads];
+
+    for(size_t t = 0; t < num_threads; t++) {
+        args[t].build = &build_parts;
+        args[t].probe = &probe_parts;
+        args[t].build_offsets = build_offsets;
+        args[t].probe_offsets = probe_offsets;
+        args[t].num_partitions = num_partitions;
+        args[t].thread_id = t;
+        args[t].num_threads = num_threads;
+        args[t].build_left = build_left;
+
+        // Run the partitions inline if we can't get another thread
+        started[t] = pthread_create(&threads[t], NULL, radix_join_worker, &args[t]) == 0;
+        if (!started[t]) {
+            radix_join_worker(&args[t]);
+        }
+    }
+
+    size_t total = 0;
+    s.code = OK;
+    for(size_t t = 0; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+        if (args[t].s.code != OK) {
+            s = args[t].s;
+        }
+        total += args[t].output.count;
+    }
+
+    free_join_input(&build_parts);
+    free_join_input(&probe_parts);
+    free(build_offsets);
+    free(probe_offsets);
+
+    // Concatenate the per-thread outputs
+    join_output out;
+    if (s.code == OK) {
+        s = init_join_output(&out, total);
+    }
+    for(size_t t = 0; t < num_threads; t++) {
+        if (s.code == OK) {
+            memcpy(out.left + out.count, args[t].output.left, args[t].output.count * sizeof(int));
+            memcpy(out.right + out.count, args[t].output.right, args[t].output.count * sizeof(int));
+            out.count += args[t].output.count;
+        }
+        free(args[t].output.left);
+        free(args[t].output.right);
+    }
+    if (s.code != OK) {
+        return s;
+    }
+
+    publish_join_output(&out, r1, r2);
+
+    s.code = OK;
+    return s;
+}
+
+// Points @in at an already sorted input, or at a sorted copy of it. Sets
+// @owned when the copy has to be freed by the caller.
+status sorted_join_input(result* vals, result* pos, join_input* in, bool* owned) {
+    status s;
+
+    if (vals->sorted) {
+        in->vals = (int*)vals->payload;
+        in->pos = (int*)pos->payload;
+        in->count = vals->num_tuples;
+        *owned = false;
+        s.code = OK;
+        return s;
+    }
+
+    kv_pair* pairs = sort_pairs((int*)vals->payload, (int*)pos->payload, vals->num_tuples);
+    if (!pairs) {
+        s.code = ERROR;
+        s.error_message = "Sort allocation failed\n";
+        return s;
+    }
+
+    s = alloc_join_input(in, vals->num_tuples);
+    if (s.code != OK) {
+        free(pairs);
+        return s;
+    }
+    for(size_t i = 0; i < in->count; i++) {
+        in->vals[i] = pairs[i].key;
+        in->pos[i] = pairs[i].pos;
+    }
+    free(pairs);
+    *owned = true;
+
+    return s;
+}
+
+status sort_merge_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2) {
+    status s = check_join_inputs(vals1, pos1, vals2, pos2);
+    if (s.code != OK) {
+        return s;
+    }
+
+    join_input left, right;
+    bool left_owned, right_owned;
+    s = sorted_join_input(vals1, pos1, &left, &left_owned);
+    if (s.code != OK) {
+        return s;
+    }
+    s = sorted_join_input(vals2, pos2, &right, &right_owned);
+    if (s.code != OK) {
+        if (left_owned) {
+            free_join_input(&left);
+        }
+        return s;
+    }
+
+    join_output out;
+    s = init_join_output(&out, left.count > right.count ? left.count : right.count);
+
+    size_t i = 0, j = 0;
+    while (s.code == OK && i < left.count && j < right.count) {
+        if (left.vals[i] < right.vals[j]) {
+            i++;
+        } else if (left.vals[i] > right.vals[j]) {
+            j++;
+        } else {
+            // Emit the cross product of the two runs of equal values
+            int key = left.vals[i];
+            size_t i_end = i, j_end = j;
+            for(; i_end < left.count && left.vals[i_end] == key; i_end++);
+            for(; j_end < right.count && right.vals[j_end] == key; j_end++);
+
+            for(size_t a = i; a < i_end && s.code == OK; a++) {
+                for(size_t b = j; b < j_end && s.code == OK; b++) {
+                    s = append_join_output(&out, left.pos[a], right.pos[b]);
+                }
+            }
+            i = i_end;
+            j = j_end;
+        }
+    }
+
+    if (left_owned) {
+        free_join_input(&left);
+    }
+    if (right_owned) {
+        free_join_input(&right);
+    }
+    if (s.code != OK) {
+        free(out.left);
+        free(out.right);
+        return s;
+    }
+
+    publish_join_output(&out, r1, r2);
+
+    s.code = OK;
+    return s;
+}
+
+bool has_bpt_index(column* col) {
+    return col && col->index && col->index->type == B_PLUS_TREE && col->index->index;
+}
+
+status index_nested_loop_join(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2) {
+    status s = check_join_inputs(vals1, pos1, vals2, pos2);
+    if (s.code != OK) {
+        return s;
+    }
+
+    column* col = vals2->source;
+    if (!has_bpt_index(col)) {
+        s.code = ERROR;
+        s.error_message = "Right join input has no B+tree index\n";
+        return s;
+    }
+
+    // The tree covers the whole column; unless the right input does too, only
+    // keep hits whose position is in it.
+    uint64_t* valid = NULL;
+    if (pos2->num_tuples != col->data_count) {
+        valid = calloc(col->data_count/64 + 1, sizeof(uint64_t));
+        if (!valid) {
+            s.code = ERROR;
+            s.error_message = "Join bitmap allocation failed\n";
+            return s;
+        }
+        int* p2 = (int*)pos2->payload;
+        for(size_t i = 0; i < pos2->num_tuples; i++) {
+            valid[p2[i] >> 6] |= (uint64_t)1 << (p2[i] & 63);
+        }
+    }
+
+    int* v1 = (int*)vals1->payload;
+    int* p1 = (int*)pos1->payload;
+    node* root = (node*)col->index->index;
+
+    join_output out;
+    s = init_join_output(&out, vals1->num_tuples);
+
+    for(size_t i = 0; i < vals1->num_tuples && s.code == OK; i++) {
+        int key = v1[i];
+
+        // Descend on key - 1 so we land left of every duplicate of key, then
+        // walk the leaves while they still hold key.
+        node* leaf = find_leaf(root, key == INT_MIN ? key : key - 1);
+        int k = key == INT_MIN ? 0 : binary_search(leaf->keys, key - 1, 0, leaf->num_keys);
+        while (leaf && s.code == OK) {
+            for(; k < leaf->num_keys && leaf->keys[k] == key; k++) {
+                int pos = (int*)leaf->pointers[k] - col->data;
+                if (valid && !(valid[pos >> 6] & ((uint64_t)1 << (pos & 63)))) {
+                    continue;
+                }
+                s = append_join_output(&out, p1[i], pos);
+                if (s.code != OK) {
+                    break;
+                }
+            }
+            if (k < leaf->num_keys) {
+                break;
+            }
+            leaf = leaf->pointers[order - 1];
+            k = 0;
+        }
+    }
+
+    free(valid);
+    if (s.code != OK) {
+        free(out.left);
+        free(out.right);
+        return s;
+    }
+
+    publish_join_output(&out, r1, r2);
+
+    s.code = OK;
+    return s;
+}
+
+status join_data(result* vals1, result* pos1, result* vals2, result* pos2, result** r1, result** r2) {
+    status s = check_join_inputs(vals1, pos1, vals2, pos2);
+    if (s.code != OK) {
+        return s;
+    }
+
+    size_t n1 = vals1->num_tuples;
+    size_t n2 = vals2->num_tuples;
+
+    // The tree answers for the positions an input holds, which it cannot
+    // do for positions that repeat, e.g. ones output by another join
+    if (n1 * INLJ_RATIO <= n2 && has_bpt_index(vals2->source) && pos2->distinct) {
+        log_info("Join: index nested loop on right input\n");
+        return index_nested_loop_join(vals1, pos1, vals2, pos2, r1, r2);
+    }
+    if (n2 * INLJ_RATIO <= n1 && has_bpt_index(vals1->source) && pos1->distinct) {
+        // Swap the inputs, and the outputs so they stay (left, right)
+        log_info("Join: index nested loop on left input\n");
+        return index_nested_loop_join(vals2, pos2, vals1, pos1, r2, r1);
+    }
+    if (vals1->sorted && vals2->sorted) {
+        log_info("Join: sort-merge\n");
+        return sort_merge_join(vals1, pos1, vals2, pos2, r1, r2);
+    }
+
+    log_info("Join: hash\n");
+    return hash_join(vals1, pos1, vals2, pos2, r1, r2);
+}
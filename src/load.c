@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "load.h"
+#include "helpers.h"
+#include "utils.h"
+
+// This tells the linker that there exists a global_db external from this
+// file.
+extern db* global_db;
+
+/**
+ * load_chunk
+ * The rows between @start and @end, which hold whole lines. They are
+ * counted first, then parsed into rows @base onwards of @cols, given in
+ * the order of the file's fields.
+ **/
+typedef struct load_chunk {
+    const char* start;
+    const char* end;
+    column** cols;
+    size_t num_cols;
+    size_t base;
+    size_t num_rows;
+    const char* error_at;
+} load_chunk;
+
+/**
+ * is_blank(p, eol)
+ * Whether the line from @p to @eol holds no row.
+ **/
+bool is_blank(const char* p, const char* eol) {
+    return p == eol || (eol - p == 1 && *p == '\r');
+}
+
+// Counts the rows of a chunk, skipping blank lines.
+void* count_worker(void* arg) {
+    load_chunk* c = (load_chunk*)arg;
+    size_t num_rows = 0;
+
+    const char* p = c->start;
+    while (p < c->end) {
+        const char* nl = memchr(p, '\n', c->end - p);
+        const char* eol = nl ? nl : c->end;
+        num_rows += !is_blank(p, eol);
+        p = eol + 1;
+    }
+    c->num_rows = num_rows;
+
+    return NULL;
+}
+
+/**
+ * parse_value(p, end, val)
+ * Reads an optionally negative decimal int at *p and moves *p past it.
+ **/
+bool parse_value(const char** p, const char* end, int* val) {
+    const char* q = *p;
+    bool negative = q < end && *q == '-';
+    q += negative;
+
+    // Leading zeros add no magnitude, so any number of them is fine
+    const char* digits = q;
+    while (q < end && *q == '0') {
+        q++;
+    }
+    uint64_t limit = (uint64_t)INT_MAX + negative;
+    uint64_t v = 0;
+    while (q < end && (unsigned)(*q - '0') < 10) {
+        v = v * 10 + (unsigned)(*q - '0');
+        if (v > limit) {
+            return false;
+        }
+        q++;
+    }
+    if (q == digits) {
+        return false;
+    }
+
+    *val = negative ? (int)(-(int64_t)v) : (int)v;
+    *p = q;
+    return true;
+}
+
+// Parses the rows of a chunk straight into their columns. Stops at the
+// first malformed line and records where it is.
+void* parse_worker(void* arg) {
+    load_chunk* c = (load_chunk*)arg;
+    size_t row = c->base;
+
+    const char* p = c->start;
+    while (p < c->end) {
+        const char* nl = memchr(p, '\n', c->end - p);
+        const char* eol = nl ? nl : c->end;
+        if (!is_blank(p, eol)) {
+            const char* line = p;
+            for(size_t j = 0; j < c->num_cols; j++) {
+                int val;
+                char sep = j + 1 < c->num_cols ? ',' : '\n';
+                if (!parse_value(&p, eol, &val) ||
+                        (sep == ',' && (p == eol || *p++ != ','))) {
+                    c->error_at = line;
+                    return NULL;
+                }
+                c->cols[j]->data[row] = val;
+            }
+            if (p < eol && !(eol - p == 1 && *p == '\r')) {
+                c->error_at = line;
+                return NULL;
+            }
+            row++;
+        }
+        p = eol + 1;
+    }
+
+    return NULL;
+}
+
+/**
+ * run_chunks(fn, chunks, num_chunks)
+ * Runs @fn over every chunk, each on its own thread when one is available.
+ **/
+void run_chunks(void* (*fn)(void*), load_chunk* chunks, size_t num_chunks) {
+    pthread_t threads[num_chunks];
+    bool started[num_chunks];
+
+    // Run the chunk inline if we can't get another thread
+    for(size_t t = 0; t < num_chunks; t++) {
+        started[t] = num_chunks > 1 &&
+            pthread_create(&threads[t], NULL, fn, &chunks[t]) == 0;
+        if (!started[t]) {
+            fn(&chunks[t]);
+        }
+    }
+    for(size_t t = 0; t < num_chunks; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+}
+
+/**
+ * load_header(header, eol, tbl_out, cols)
+ * Finds the table and columns, in file order, named by the header line.
+ * @cols must have room for DEFAULT_NUM_COLS columns.
+ **/
+status load_header(const char* header, const char* eol, table** tbl_out, column** cols) {
+    status s;
+    s.code = ERROR;
+
+    if (eol > header && eol[-1] == '\r') {
+        eol--;
+    }
+
+    table* tbl = NULL;
+    size_t num_cols = 0;
+    const char* name = header;
+    while (name <= eol) {
+        const char* comma = memchr(name, ',', eol - name);
+        size_t len = (comma ? comma : eol) - name;
+
+        if (!tbl) {
+            int tbl_idx = find_table_from_col_name(name, len);
+            if (tbl_idx == -1) {
+                s.error_message = "Cannot find table.\n";
+                return s;
+            }
+            tbl = global_db->tables[tbl_idx];
+        }
+
+        int col_idx = find_column(tbl, name, len);
+        if (col_idx == -1 || num_cols == tbl->col_count) {
+            s.error_message = "Load file names a column not in the table\n";
+            return s;
+        }
+        for(size_t j = 0; j < num_cols; j++) {
+            if (cols[j] == tbl->col[col_idx]) {
+                s.error_message = "Load file names a column twice\n";
+                return s;
+            }
+        }
+        cols[num_cols++] = tbl->col[col_idx];
+
+        if (!comma) {
+            break;
+        }
+        name = comma + 1;
+    }
+
+    if (!tbl || num_cols != tbl->col_count) {
+        s.error_message = "Load file must name every column of the table\n";
+        return s;
+    }
+
+    *tbl_out = tbl;
+    s.code = OK;
+    return s;
+}
+
+/**
+ * load_commit(tbl, num_rows)
+ * Makes the @num_rows rows written past the end of @tbl's columns part of
+ * the table, and rebuilds its indexes over them.
+ **/
+status load_commit(table* tbl, size_t num_rows) {
+    for(size_t j = 0; j < tbl->col_count; j++) {
+        column* col = tbl->col[j];
+        col->data_count += num_rows;
+        col->dirty = true;
+        invalidate_index(col);
+    }
+    log_info("Loaded %zu rows into %s\n", num_rows, tbl->name);
+
+    return process_indexes(tbl);
+}
+
+/**
+ * load_rows(text, size)
+ * Appends the rows of the CSV @text, header line first.
+ **/
+status load_rows(const char* text, size_t size) {
+    status s;
+    const char* end = text + size;
+
+    const char* nl = memchr(text, '\n', size);
+    const char* body = nl ? nl + 1 : end;
+
+    table* tbl;
+    column* cols[DEFAULT_NUM_COLS];
+    s = load_header(text, nl ? nl : end, &tbl, cols);
+    if (s.code != OK) {
+        return s;
+    }
+
+    // Split the rows into chunks of whole lines
+    size_t num_chunks = end - body >= PARALLEL_LOAD_THRESHOLD ? DEFAULT_NUM_THREADS : 1;
+    load_chunk chunks[num_chunks];
+    const char* start = body;
+    for(size_t t = 0; t < num_chunks; t++) {
+        const char* stop = end;
+        if (t + 1 < num_chunks) {
+            stop = body + (end - body) / num_chunks * (t + 1);
+            stop = stop < start ? start : stop;
+            const char* split = memchr(stop, '\n', end - stop);
+            stop = split ? split + 1 : end;
+        }
+        chunks[t].start = start;
+        chunks[t].end = stop;
+        chunks[t].cols = cols;
+        chunks[t].num_cols = tbl->col_count;
+        chunks[t].error_at = NULL;
+        start = stop;
+    }
+
+    // Count rows first so every chunk knows where its rows go
+    run_chunks(count_worker, chunks, num_chunks);
+    size_t existing = tbl->col_count ? tbl->col[0]->data_count : 0;
+    size_t num_rows = 0;
+    for(size_t t = 0; t < num_chunks; t++) {
+        chunks[t].base = existing + num_rows;
+        num_rows += chunks[t].num_rows;
+    }
+
+    for(size_t j = 0; j < tbl->col_count; j++) {
+        s = col_reserve(tbl->col[j], existing + num_rows);
+        if (s.code != OK) {
+            return s;
+        }
+    }
+
+    // Rows are written past each column's end, so until the counts move a
+    // failed load leaves the table as it was
+    run_chunks(parse_worker, chunks, num_chunks);
+    for(size_t t = 0; t < num_chunks; t++) {
+        if (chunks[t].error_at) {
+            const char* eol = memchr(chunks[t].error_at, '\n', end - chunks[t].error_at);
+            int len = (int)((eol ? eol : end) - chunks[t].error_at);
+            log_err("Malformed row: %.*s\n", len, chunks[t].error_at);
+            s.code = ERROR;
+            s.error_message = "Malformed row in load file\n";
+            return s;
+        }
+    }
+
+    return load_commit(tbl, num_rows);
+}
+
+status load_file(const char* path, bool* readable) {
+    status s;
+    s.code = ERROR;
+    s.error_message = "Cannot read load file\n";
+    *readable = false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return s;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return s;
+    }
+    *readable = true;
+
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        s.error_message = "Load file is empty\n";
+        return s;
+    }
+
+    char* text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        s.error_message = "Error mapping load file\n";
+        return s;
+    }
+    madvise(text, size, MADV_SEQUENTIAL);
+
+    s = load_rows(text, size);
+    munmap(text, size);
+    return s;
+}
+
+status load_batches(const char* header, const char* batches, size_t len) {
+    table* tbl;
+    column* cols[DEFAULT_NUM_COLS];
+    status s = load_header(header, header + strcspn(header, "\n"), &tbl, cols);
+    if (s.code != OK) {
+        return s;
+    }
+
+    // Size the columns once for every batch
+    size_t num_rows = 0;
+    const char* p = batches;
+    while (p < batches + len) {
+        size_t shape[2];
+        memcpy(shape, p, sizeof(shape));
+        if (shape[1] != tbl->col_count) {
+            s.code = ERROR;
+            s.error_message = "Load batch does not match the table's columns\n";
+            return s;
+        }
+        num_rows += shape[0];
+        p += sizeof(shape) + shape[0] * shape[1] * sizeof(int);
+    }
+
+    size_t existing = tbl->col_count ? tbl->col[0]->data_count : 0;
+    for(size_t j = 0; j < tbl->col_count; j++) {
+        s = col_reserve(tbl->col[j], existing + num_rows);
+        if (s.code != OK) {
+            return s;
+        }
+    }
+
+    // Each batch holds its columns one after another
+    size_t row = existing;
+    p = batches;
+    while (p < batches + len) {
+        size_t shape[2];
+        memcpy(shape, p, sizeof(shape));
+        p += sizeof(shape);
+        for(size_t j = 0; j < tbl->col_count; j++) {
+            memcpy(cols[j]->data + row, p, shape[0] * sizeof(int));
+            p += shape[0] * sizeof(int);
+        }
+        row += shape[0];
+    }
+
+    return load_commit(tbl, num_rows);
+}
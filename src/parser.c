@@ -1,718 +1,742 @@
 #include "parser.h"
 
-#include <regex.h>
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdio.h>
 
 #include "db.h"
 #include "utils.h"
 #include "helpers.h"
 
 
-// This tells the linker that there exists a global_db and catalog external
-// from this file.
+// This tells the linker that there exists a global_db external from this
+// file.
 extern db* global_db;
-extern catalog** catalogs;
-extern select_queue* queue;
 
-// Prototype for Helper function that executes that actual parsing after
-// parse_command_string has found a matching regex.
-status parse_dsl(char* str, dsl* d, db_operator* op);
-
-// Finds a possible matching DSL command by using regular expressions.
-// If it finds a match, it calls parse_command to actually process the dsl.
-status parse_command_string(char* str, dsl** commands, db_operator* op)
-{
-    log_info("Parsing: %s", str);
-
-    // Create a regular expression to parse the string
-    regex_t regex;
-    int ret;
+/**
+ * token
+ * A run of the query text. Tokens are never copied or terminated; lookups
+ * take their length.
+ **/
+typedef struct token {
+    const char* start;
+    size_t len;
+} token;
+
+/**
+ * lexer
+ * The parser's place in the query @str, the scratch it writes into and
+ * the first error it ran into.
+ **/
+typedef struct lexer {
+    const char* str;
+    const char* pos;
+    parse_scratch* mem;
+    status err;
+} lexer;
+
+/**
+ * lex_alloc(lx, size)
+ * Carves @size bytes out of the scratch, or returns NULL if it is full.
+ **/
+void* lex_alloc(lexer* lx, size_t size) {
+    parse_scratch* mem = lx->mem;
+    size_t align = sizeof(mem->data.align);
+    size_t start = (mem->used + align - 1) / align * align;
+    if (start > PARSE_SCRATCH_SIZE || PARSE_SCRATCH_SIZE - start < size) {
+        return NULL;
+    }
+    mem->used = start + size;
+    return mem->data.bytes + start;
+}
 
-    // Track the number of matches; a string must match all
-    int n_matches = 1;
-    regmatch_t m;
+/**
+ * lex_fail(lx, at, what)
+ * Records the error @what, found at @at in the query. Returns false so
+ * that callers can bail out with it.
+ **/
+bool lex_fail(lexer* lx, const char* at, const char* what) {
+    lx->err.code = ERROR;
+    lx->err.error_message = "Malformed query\n";
+
+    size_t len = strlen(what) + 32;
+    char* msg = lex_alloc(lx, len);
+    if (msg) {
+        snprintf(msg, len, "%s at column %d\n", what, (int) (at - lx->str) + 1);
+        lx->err.error_message = msg;
+    }
+    log_err(lx->err.error_message);
+    return false;
+}
 
-    for (int i = 0; i < NUM_DSL_COMMANDS; ++i) {
-        dsl* d = commands[i];
-        if (regcomp(&regex, d->c, REG_EXTENDED) != 0) {
-            log_err("Could not compile regex\n");
-        }
+/**
+ * lex_expect(lx, c)
+ * Consumes the character @c the grammar requires next.
+ **/
+bool lex_expect(lexer* lx, char c) {
+    if (*lx->pos != c) {
+        char what[] = "Expected ' '";
+        what[10] = c;
+        return lex_fail(lx, lx->pos, what);
+    }
+    lx->pos++;
+    return true;
+}
 
-        // Bind regular expression associated with the string
-        ret = regexec(&regex, str, n_matches, &m, 0);
-        // If we have a match, then figure out which one it is!
-        if (ret == 0) {
-            log_info("Found Command: %d\n", i);
-            // Here, we actually strip the command as appropriately
-            // based on the DSL to get the variable names.
-            return parse_dsl(str, d, op);
-        }
+/**
+ * lex_word(lx, t, what)
+ * Reads a name or number into @t; @what is the error if there is none.
+ **/
+bool lex_word(lexer* lx, token* t, const char* what) {
+    t->start = lx->pos;
+    while (isalnum((unsigned char) *lx->pos) || *lx->pos == '_' ||
+            *lx->pos == '.' || *lx->pos == '-') {
+        lx->pos++;
     }
+    t->len = lx->pos - t->start;
+    if (t->len == 0) {
+        return lex_fail(lx, t->start, what);
+    }
+    return true;
+}
 
-    // Nothing was found!
-    status s;
-    s.code = ERROR;
-    s.error_message = "Cannot find match\n";
-    log_err(s.error_message);
-    return s;
+/**
+ * lex_quoted(lx, t)
+ * Reads a name in double quotes into @t.
+ **/
+bool lex_quoted(lexer* lx, token* t) {
+    return lex_expect(lx, '"') && lex_word(lx, t, "Expected a name") && lex_expect(lx, '"');
 }
 
-status parse_dsl(char* str, dsl* d, db_operator* op) {
-    // Use the commas to parse out the string
-    char open_paren[2] = "(";
-    char close_paren[2] = ")";
-    char comma[2] = ",";
-    char quotes[2] = "\"";
-    // char end_line[2] = "\n";
-    // char eq_sign[2] = "=";
+/**
+ * token_is(t, word)
+ * Whether @t is exactly @word.
+ **/
+bool token_is(token t, const char* word) {
+    return strlen(word) == t.len && strncmp(t.start, word, t.len) == 0;
+}
 
-    if (d->g == CREATE_DB) {
-        // Declare status
-        status s;
+/**
+ * lex_int(lx, t, val)
+ * Reads the integer @t into @val.
+ **/
+bool lex_int(lexer* lx, token t, int* val) {
+    size_t i = 0;
+    bool negative = t.len > 0 && t.start[0] == '-';
+    if (negative) {
+        i++;
+    }
+    if (i == t.len) {
+        return lex_fail(lx, t.start, "Expected a number");
+    }
 
-        // Check if DB exists
-        if (global_db) {
-            s.code = ERROR;
-            s.error_message = "DB already exists\n";
-            log_err(s.error_message);
-            return s;
+    long long v = 0;
+    for(; i < t.len; i++) {
+        if (!isdigit((unsigned char) t.start[i])) {
+            return lex_fail(lx, t.start, "Expected a number");
         }
+        v = v * 10 + (t.start[i] - '0');
+        if (v > (long long) INT_MAX + negative) {
+            return lex_fail(lx, t.start, "Number out of range");
+        }
+    }
+    *val = (int) (negative ? -v : v);
+    return true;
+}
 
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str));
-        strncpy(str_cpy, str, strlen(str));
-
-        // This gives us everything inside the (db, "<db_name>")
-        strtok(str_cpy, open_paren);
-        char* args = strtok(NULL, close_paren);
-
-        // This gives us "db", but we don't need to use it
-        char* db_indicator = strtok(args, comma);
-        (void) db_indicator;
-
-        // This gives us "<db_name>"
-        char* db_name = strtok(NULL, quotes);
-
-        log_info("create_db(%s)\n", db_name);
-
-        // Here, we can create the DB using our parsed info!
-        db* db1 = NULL;
-        s = create_db(db_name, &db1);
+/**
+ * lex_bound(lx, t, if_null, val)
+ * Reads the select bound @t into @val; "null" leaves the range open and
+ * reads as @if_null.
+ **/
+bool lex_bound(lexer* lx, token t, int if_null, int* val) {
+    if (token_is(t, "null")) {
+        *val = if_null;
+        return true;
+    }
+    return lex_int(lx, t, val);
+}
 
-        // Free the str_cpy
-        // free(str_cpy);
+/**
+ * lex_name(lx, prefix, t)
+ * Copies @t into the scratch as a string, after @prefix and a '.' if
+ * @prefix is given. Returns NULL if the scratch is full.
+ **/
+char* lex_name(lexer* lx, token* prefix, token t) {
+    size_t len = t.len + (prefix ? prefix->len + 1 : 0);
+    char* name = lex_alloc(lx, len + 1);
+    if (!name) {
+        lex_fail(lx, t.start, "Query too long");
+        return NULL;
+    }
 
-        if (s.code != OK) {
-            // Something went wrong
-            log_err(s.error_message);
-            return s;
-        }
+    char* p = name;
+    if (prefix) {
+        memcpy(p, prefix->start, prefix->len);
+        p += prefix->len;
+        *p++ = '.';
+    }
+    memcpy(p, t.start, t.len);
+    p[t.len] = '\0';
+    return name;
+}
 
-        // Set global DB variable
-        global_db = db1;
+/**
+ * table_ref(lx, t, tbl_idx)
+ * Looks up the table named @t.
+ **/
+bool table_ref(lexer* lx, token t, int* tbl_idx) {
+    *tbl_idx = find_table(t.start, t.len);
+    if (*tbl_idx == -1) {
+        return lex_fail(lx, t.start, "Cannot find table");
+    }
+    return true;
+}
 
-        op->type = CREATE_OP;
-        return s;
-    } else if (d->g == CREATE_TABLE) {
-        status s;
-        
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        // This gives us everything inside the (table, <tbl_name>, <db_name>, <count>)
-        strtok(str_cpy, open_paren);
-        char* args = strtok(NULL, close_paren);
-
-        // This gives us "table"
-        char* tbl_indicator = strtok(args, comma);
-        (void) tbl_indicator;
-
-        // This gives us <tbl_name>, we will need this to create the full name
-        char* tbl_name = strtok(NULL, quotes);
-
-        // This gives us <db_name>, we will need this to create the full name
-        char* db_name = strtok(NULL, comma);
-
-        // Generate the full name using <db_name>.<tbl_name>
-        size_t name_len = strlen(tbl_name) + strlen(db_name) + 2;
-        char* full_name = (char*)malloc(sizeof(char)*(name_len));
-        memset(full_name, '\0', name_len); 
-
-        strncat(full_name, db_name, strlen(db_name));
-        strncat(full_name, ".", 1);
-        strncat(full_name, tbl_name, strlen(tbl_name));
-        
-        // This gives us count
-        char* count_str = strtok(NULL, comma);
-        int count = 0;
-        if (count_str != NULL) {
-            count = atoi(count_str);
-        }
-        (void) count;
-
-        log_info("create_table(%s, %s, %d)\n", full_name, db_name, count);
-        
-        // Check if table already exists
-        int tbl_idx = find_table(full_name);
-        if (tbl_idx != -1) {
-            s.code = ERROR;
-            s.error_message = "Table name already exists\n";
-            log_err(s.error_message);
-            return s;
-        }
-
-        // Here, we can create the table using our parsed info!
-        table* tbl1 = NULL;
-        s = create_table(global_db, full_name, count, &tbl1);
-
-        // Free the str_cpy
-        // free(str_cpy);
-        // free(full_name);
-        str_cpy=NULL;
-        full_name=NULL;
-
-        if (s.code != OK) {
-            // Something went wrong
-            log_err(s.error_message);
-            return s;
-        }
+/**
+ * column_ref(lx, t, tbl_idx, col_idx)
+ * Looks up the column named @t, fully qualified.
+ **/
+bool column_ref(lexer* lx, token t, int* tbl_idx, int* col_idx) {
+    *tbl_idx = find_table_from_col_name(t.start, t.len);
+    if (*tbl_idx == -1) {
+        return lex_fail(lx, t.start, "Cannot find table");
+    }
+    *col_idx = find_column(global_db->tables[*tbl_idx], t.start, t.len);
+    if (*col_idx == -1) {
+        return lex_fail(lx, t.start, "Cannot find column");
+    }
+    return true;
+}
 
-        op->type = CREATE_OP;
-        return s;
-    } else if (d->g == CREATE_COLUMN) {
-        status s;
+/**
+ * result_ref(lx, t, r)
+ * Looks up the client's variable named @t.
+ **/
+bool result_ref(lexer* lx, token t, result** r) {
+    *r = find_result(t.start, t.len);
+    if (!*r) {
+        return lex_fail(lx, t.start, "Cannot find previous result");
+    }
+    return true;
+}
 
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
+/**
+ * find_vector_column(t)
+ * The column named @t, or NULL if there is none.
+ **/
+column* find_vector_column(token t) {
+    int tbl_idx = find_table_from_col_name(t.start, t.len);
+    if (tbl_idx == -1) {
+        return NULL;
+    }
+    table* tbl = global_db->tables[tbl_idx];
+    int col_idx = find_column(tbl, t.start, t.len);
+    return col_idx == -1 ? NULL : tbl->col[col_idx];
+}
 
-        // This gives us everything inside the (col, <col_name>, <tbl_name>, unsorted)
-        strtok(str_cpy, open_paren);
-        char* args = strtok(NULL, close_paren);
+/**
+ * vector_ref(lx, t, r)
+ * Looks up the vector @t, either one of the client's variables or a whole
+ * column. Columns are wrapped in a result in the scratch.
+ **/
+bool vector_ref(lexer* lx, token t, result** r) {
+    *r = find_result(t.start, t.len);
+    if (*r) {
+        return true;
+    }
 
-        // This gives us "col"
-        char* col_indicator = strtok(args, comma);
-        (void) col_indicator;
+    column* col = find_vector_column(t);
+    if (!col) {
+        return lex_fail(lx, t.start, "Cannot find var");
+    }
+    *r = lex_alloc(lx, sizeof(struct result));
+    if (!*r) {
+        return lex_fail(lx, t.start, "Query too long");
+    }
+    (*r)->payload = col->data;
+    (*r)->num_tuples = col->data_count;
+    (*r)->type = INT;
+    (*r)->max_size = 0;
+    (*r)->sorted = false;
+    (*r)->source = col;
+    (*r)->num_bits = 0;
+    (*r)->distinct = false;
+    return true;
+}
 
-        // This gives us <col_name>, we will need this to create the full name
-        char* col_name = strtok(NULL, quotes);
+/**
+ * num_outputs(g)
+ * How many variables the commands of group @g assign.
+ **/
+int num_outputs(DSLGroup g) {
+    if (g == HASH_JOIN || g == PLANNED_JOIN) {
+        return 2;
+    } else if (g == SELECT_TYPE1_COLUMN || g == SELECT_TYPE2_COLUMN ||
+            g == PROJECT_COLUMN || g == AVG_RESULT || g == MAX_RESULT ||
+            g == MIN_RESULT || g == ADD_RESULT || g == SUB_RESULT ||
+            g == CNT_RESULT) {
+        return 1;
+    }
+    return 0;
+}
 
-        // This gives us <tbl_name>, we will need this to create the full name
-        char* tbl_name = strtok(NULL, comma);
-        
-        // Generate the full name using <db_name>.<tbl_name>
-        size_t name_len = strlen(tbl_name) + strlen(col_name) + 2;
-        char* full_name=(char*)malloc(sizeof(char)*(name_len));
-        memset(full_name, '\0', name_len); 
+// Prototype for the helper that parses the arguments of a command once
+// parse_command_string has found which one it is.
+bool parse_dsl(lexer* lx, DSLGroup g, db_operator* op);
 
-        strncat(full_name, tbl_name, strlen(tbl_name));
-        strncat(full_name, ".", 1);
-        strncat(full_name, col_name, strlen(col_name));
+// Finds the DSL command the query starts with, past any variables being
+// assigned, and parses the rest of it in the same pass.
+status parse_command_string(const char* str, dsl** commands, db_operator* op,
+        parse_scratch* mem)
+{
+    log_info("Parsing: %s", str);
 
-        // This gives us the "unsorted"
-        char* sorting_str = strtok(NULL, comma); 
-        bool sorted = false;
-        if (strcmp(sorting_str, "sorted") == 0) {
-            sorted = true;
+    lexer lx;
+    lx.str = str;
+    lx.pos = str;
+    lx.mem = mem;
+    lx.err.code = OK;
+    mem->used = 0;
+
+    // <var>= or <var1>,<var2>=
+    token outputs[2];
+    int num_outs = 0;
+    token first;
+    first.start = lx.pos;
+    while (isalnum((unsigned char) *lx.pos) || *lx.pos == '_') {
+        lx.pos++;
+    }
+    first.len = lx.pos - first.start;
+    if (first.len > 0 && (*lx.pos == '=' || *lx.pos == ',')) {
+        outputs[num_outs++] = first;
+        if (*lx.pos == ',') {
+            lx.pos++;
+            if (!lex_word(&lx, &outputs[num_outs++], "Expected a result name")) {
+                return lx.err;
+            }
         }
-
-        log_info("create_column(%s, %s, %s)\n", full_name, tbl_name, sorting_str);
-
-        // Check that table already exists
-        int tbl_idx = find_table(tbl_name);
-        if (tbl_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find table\n";
-            log_err(s.error_message);
-            return s;
+        if (!lex_expect(&lx, '=')) {
+            return lx.err;
         }
-        table* table1 = global_db->tables[tbl_idx];
+    } else {
+        lx.pos = first.start;
+    }
 
-        // Check that column doesn't already exist
-        int col_idx = find_column(table1, full_name);
-        if (col_idx != -1) {
-            s.code = ERROR;
-            s.error_message = "Column name already exists\n";
-            log_err(s.error_message);
-            return s;
+    dsl* d = NULL;
+    for (int i = 0; i < NUM_DSL_COMMANDS; ++i) {
+        size_t len = strlen(commands[i]->name);
+        if (strncmp(lx.pos, commands[i]->name, len) == 0) {
+            d = commands[i];
+            lx.pos += len;
+            break;
         }
+    }
+    if (!d) {
+        lex_fail(&lx, lx.pos, "Unknown command");
+        return lx.err;
+    }
 
-        // Here, we can create the column using our parsed info!
-        column* col1 = NULL;
-        s = create_column(table1, full_name, &col1, sorted);
-
-        // Free the str_cpy
-        // free(str_cpy);
-        // free(full_name);
-        str_cpy=NULL;
-        full_name=NULL;
-
-        if (s.code != OK) {
-            // Something went wrong
-            log_err(s.error_message);
-            return s;
+    int want = num_outputs(d->g);
+    if (num_outs != want) {
+        if (want == 0) {
+            lex_fail(&lx, str, "Command does not assign a result");
+        } else if (want == 1) {
+            lex_fail(&lx, str, "Expected one result name");
+        } else {
+            lex_fail(&lx, str, "Expected two result names");
         }
+        return lx.err;
+    }
+    if (num_outs > 0 && !(op->name1 = lex_name(&lx, NULL, outputs[0]))) {
+        return lx.err;
+    }
+    if (num_outs > 1 && !(op->name2 = lex_name(&lx, NULL, outputs[1]))) {
+        return lx.err;
+    }
 
-        op->type = CREATE_OP;
-        return s;
-    } else if (d->g == RELATIONAL_INSERT) {
-        status s;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        // This gives us everything inside the parens
-        strtok(str_cpy, open_paren);
-        char* args = strtok(NULL, close_paren);
-        char* tbl_name = strtok(args, comma);
-
-        // Find table and check if it's valid
-        int tbl_idx = find_table(tbl_name);
-        if (tbl_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find table\n";
-            log_err(s.error_message);
-            return s;
-        }
-
-        // Advance pointer to actual values
-        char* vals = (char*)(args + strlen(tbl_name) + 1);
-        
-        s = relational_insert(tbl_idx, vals, op);
-
-        // free(str_cpy);
-        return s;
-    } else if (d->g == SELECT_TYPE1_COLUMN) {
-        status s;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-        op->name1[strlen(var_name)] = '\0';
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* args = strtok(NULL, close_paren);
-
-        char vals[strlen(args)];
-        strcpy(vals, args);
-
-        char* arg = strtok(args, comma);
-        char col_name[strlen(arg)];
-        strcpy(col_name, arg);
-
-        int tbl_idx = find_table_from_col_name(arg);
-        if (tbl_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find table\n";
-            log_err(s.error_message);
-            return s;
-        }
-        table* table1 = global_db->tables[tbl_idx];
-
-        int col_idx = find_column(table1, col_name);
-        if (col_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find column\n";
-            log_err(s.error_message);
-            return s;
-        }
-
-        strtok(vals, comma);
-        char* val1 = strtok(NULL, comma);
-        int lower = create_lower_bound(val1);
-        char* val2 = strtok(NULL, comma);
-        int upper = create_upper_bound(val2);
-
-        op->type = SELECT;
-        op->columns = (column**)(table1->col + col_idx);
-        op->lower = lower;
-        op->upper = upper;
-
-        s.code = OK;
-        return s;
-    } else if (d->g == SELECT_TYPE2_COLUMN) {
-        status s;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-        op->name1[strlen(var_name)] = '\0';
+    if (!parse_dsl(&lx, d->g, op)) {
+        return lx.err;
+    }
 
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* args = strtok(NULL, close_paren);
+    // Only the line break may follow
+    while (isspace((unsigned char) *lx.pos)) {
+        lx.pos++;
+    }
+    if (*lx.pos != '\0') {
+        lex_fail(&lx, lx.pos, "Unexpected input");
+        return lx.err;
+    }
 
-        char* arg = strtok(args, comma);
-        op->result1 = find_result(arg);
-        arg = strtok(NULL, comma);
-        op->result2 = find_result(arg);
+    log_info("Found Command: %d\n", d->g);
+    status s;
+    s.code = OK;
+    return s;
+}
 
-        if (!op->result1 || !op->result2) {
-            s.code = ERROR;
-            s.error_message = "Cannot find previous result\n";
-            return s;
+bool parse_dsl(lexer* lx, DSLGroup g, db_operator* op) {
+    if (g == CREATE_DB) {
+        // create(db,"<db_name>")
+        token name;
+        if (!lex_quoted(lx, &name) || !lex_expect(lx, ')')) {
+            return false;
         }
 
-        char* val1 = strtok(NULL, comma);
-        int lower = create_lower_bound(val1);
-        char* val2 = strtok(NULL, comma);
-        int upper = create_upper_bound(val2);
-
-        op->type = SELECT;
-        op->lower = lower;
-        op->upper = upper;
-
-        s.code = OK;
-        return s;
-    } else if (d->g == PROJECT_COLUMN) {
-        status s;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-        op->name1[strlen(var_name)] = '\0';
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* args = strtok(NULL, close_paren);
-
-        char* arg = strtok(args, comma);
-        char col_name[strlen(arg)];
-        strcpy(col_name, arg);
-        char* name = strtok(NULL, comma);
-        op->result1 = find_result(name);
-
-        int tbl_idx = find_table_from_col_name(arg);
-        if (tbl_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find table\n";
-            log_err(s.error_message);
-            return s;
-        }
-        table* table1 = global_db->tables[tbl_idx];
-
-        int col_idx = find_column(table1, col_name);
-        if (col_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find column\n";
-            log_err(s.error_message);
-            return s;
+        op->type = CREATE_OP;
+        op->object = DB_OBJECT;
+        op->name1 = lex_name(lx, NULL, name);
+        return op->name1 != NULL;
+    } else if (g == CREATE_TABLE) {
+        // create(tbl,"<tbl_name>",<db_name>,<col_count>)
+        token name, db_name, count_str;
+        int count;
+        if (!lex_quoted(lx, &name) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &db_name, "Expected a db name") || !lex_expect(lx, ',') ||
+                !lex_word(lx, &count_str, "Expected a column count") ||
+                !lex_int(lx, count_str, &count) || !lex_expect(lx, ')')) {
+            return false;
+        }
+        if (count < 0) {
+            return lex_fail(lx, count_str.start, "Expected a column count");
+        }
+
+        // Tables are named <db_name>.<tbl_name>
+        op->type = CREATE_OP;
+        op->object = TABLE_OBJECT;
+        op->num_cols = count;
+        op->name1 = lex_name(lx, &db_name, name);
+        return op->name1 != NULL;
+    } else if (g == CREATE_COLUMN) {
+        // create(col,"<col_name>",<tbl_name>,sorted|unsorted)
+        token name, tbl_name, order;
+        int tbl_idx;
+        if (!lex_quoted(lx, &name) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &tbl_name, "Expected a table name") ||
+                !table_ref(lx, tbl_name, &tbl_idx) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &order, "Expected sorted or unsorted")) {
+            return false;
+        }
+        if (token_is(order, "sorted")) {
+            op->sorted = true;
+        } else if (token_is(order, "unsorted")) {
+            op->sorted = false;
+        } else {
+            return lex_fail(lx, order.start, "Expected sorted or unsorted");
+        }
+        if (!lex_expect(lx, ')')) {
+            return false;
+        }
+
+        // Columns are named <tbl_name>.<col_name>
+        op->type = CREATE_OP;
+        op->object = COLUMN_OBJECT;
+        op->tables = global_db->tables + tbl_idx;
+        op->name1 = lex_name(lx, &tbl_name, name);
+        return op->name1 != NULL;
+    } else if (g == CREATE_INDEX) {
+        // create(idx,<col_name>,<index_type>)
+        token col_name, type_str;
+        int tbl_idx, col_idx;
+        if (!lex_word(lx, &col_name, "Expected a column name") ||
+                !column_ref(lx, col_name, &tbl_idx, &col_idx) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &type_str, "Expected an index type")) {
+            return false;
+        }
+        if (token_is(type_str, "btree")) {
+            op->index_type = B_PLUS_TREE;
+        } else if (token_is(type_str, "sorted")) {
+            op->index_type = SORTED;
+        } else if (token_is(type_str, "csstree")) {
+            op->index_type = CSS_TREE;
+        } else if (token_is(type_str, "cracked")) {
+            op->index_type = CRACKED;
+        } else {
+            return lex_fail(lx, type_str.start, "Unknown index type");
+        }
+        if (!lex_expect(lx, ')')) {
+            return false;
         }
 
-        op->type = PROJECT;
-        op->columns = (column**)(table1->col + col_idx);
-
-        if (!op->result1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find previous result\n";
-            log_err(s.error_message);
-            return s;
-        }
-
-        s.code = OK;
-        return s;
-    } else if (d->g == TUPLE_RESULT) {
-        status s;
-
-        tuples* tups = init_tuples();
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        // This gives us everything inside the parens
-        strtok(str_cpy, open_paren);
-        char* args = strtok(NULL, close_paren);
-        char* vec_name;
-        while((vec_name = strtok(args, comma))) {
-            char vec_name_copy[strlen(vec_name)];
-            strcpy(vec_name_copy, vec_name);
-            result* res = NULL;
-            s = prepare_result(vec_name_copy, &res);
-            if (s.code != OK) {
-                log_err(s.error_message);
-                return s;
+        op->type = CREATE_OP;
+        op->object = INDEX_OBJECT;
+        op->tables = global_db->tables + tbl_idx;
+        op->columns = global_db->tables[tbl_idx]->col + col_idx;
+        return true;
+    } else if (g == RELATIONAL_INSERT) {
+        // relational_insert(<tbl_name>,<val1>,...,<valN>)
+        token tbl_name, val;
+        int tbl_idx;
+        if (!lex_word(lx, &tbl_name, "Expected a table name") ||
+                !table_ref(lx, tbl_name, &tbl_idx)) {
+            return false;
+        }
+        table* tbl = global_db->tables[tbl_idx];
+
+        int* vals = lex_alloc(lx, tbl->col_count * sizeof(int));
+        if (!vals) {
+            return lex_fail(lx, lx->pos, "Query too long");
+        }
+        for(size_t i = 0; i < tbl->col_count; i++) {
+            if (*lx->pos != ',') {
+                return lex_fail(lx, lx->pos, "Not enough values to insert");
+            }
+            lx->pos++;
+            if (!lex_word(lx, &val, "Expected a number") || !lex_int(lx, val, &vals[i])) {
+                return false;
             }
-            tups->payloads[tups->num_cols] = res->payload;
-            tups->num_cols++;
-            tups->num_rows = res->num_tuples;
-            tups->type = res->type;
-            args = NULL;
         }
-        
-        op->type = TUPLE;
-        op->tups = tups;
-
-        s.code = OK;
-        return s;
-    } else if (d->g == AVG_RESULT) {
-        status s;
-
-        op->type = AGGREGATE;
-        op->agg = AVG;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* vec_name = strtok(NULL, close_paren);
-
-        s = prepare_result(vec_name, &(op->result1));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        if (*lx->pos == ',') {
+            return lex_fail(lx, lx->pos, "Values exceed number of columns");
+        }
+        if (!lex_expect(lx, ')')) {
+            return false;
+        }
+
+        op->type = INSERT;
+        op->tables = global_db->tables + tbl_idx;
+        op->columns = tbl->col;
+        op->value1 = vals;
+        return true;
+    } else if (g == RELATIONAL_UPDATE) {
+        // relational_update(<col_name>,<pos_var>,<new_val>)
+        token col_name, pos_name, val;
+        int tbl_idx, col_idx;
+        int* vals = lex_alloc(lx, sizeof(int));
+        if (!vals) {
+            return lex_fail(lx, lx->pos, "Query too long");
+        }
+        if (!lex_word(lx, &col_name, "Expected a column name") ||
+                !column_ref(lx, col_name, &tbl_idx, &col_idx) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &pos_name, "Expected a variable") ||
+                !result_ref(lx, pos_name, &op->result1) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &val, "Expected a number") || !lex_int(lx, val, vals) ||
+                !lex_expect(lx, ')')) {
+            return false;
+        }
+
+        op->type = UPDATE;
+        op->tables = global_db->tables + tbl_idx;
+        op->columns = global_db->tables[tbl_idx]->col + col_idx;
+        op->value1 = vals;
+        return true;
+    } else if (g == RELATIONAL_DELETE) {
+        // relational_delete(<tbl_name>,<pos_var>)
+        token tbl_name, pos_name;
+        int tbl_idx;
+        if (!lex_word(lx, &tbl_name, "Expected a table name") ||
+                !table_ref(lx, tbl_name, &tbl_idx) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &pos_name, "Expected a variable") ||
+                !result_ref(lx, pos_name, &op->result1) || !lex_expect(lx, ')')) {
+            return false;
+        }
+
+        op->type = DELETE;
+        op->tables = global_db->tables + tbl_idx;
+        return true;
+    } else if (g == SELECT_TYPE1_COLUMN || g == SELECT_TYPE2_COLUMN) {
+        // select(<col_name>,<lower>,<upper>) or
+        // select(<pos_var>,<val_var>,<lower>,<upper>); which one is only
+        // known from the number of arguments.
+        token args[4];
+        int num_args = 0;
+        while (1) {
+            if (num_args == 4) {
+                return lex_fail(lx, lx->pos, "Expected ')'");
+            }
+            if (!lex_word(lx, &args[num_args++], "Expected an argument")) {
+                return false;
+            }
+            if (*lx->pos != ',') {
+                break;
+            }
+            lx->pos++;
         }
-
-        return s;
-    } else if (d->g == MAX_RESULT) {
-        status s;
-
-        op->type = AGGREGATE;
-        op->agg = MAX;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* vec_name = strtok(NULL, close_paren);
-
-        s = prepare_result(vec_name, &(op->result1));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        if (!lex_expect(lx, ')')) {
+            return false;
         }
 
-        return s;
-    } else if (d->g == MIN_RESULT) {
-        status s;
-
-        op->type = AGGREGATE;
-        op->agg = MIN;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* vec_name = strtok(NULL, close_paren);
-
-        s = prepare_result(vec_name, &(op->result1));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        if (num_args == 3) {
+            int tbl_idx, col_idx;
+            if (!column_ref(lx, args[0], &tbl_idx, &col_idx)) {
+                return false;
+            }
+            op->columns = global_db->tables[tbl_idx]->col + col_idx;
+        } else if (num_args == 4) {
+            if (!result_ref(lx, args[0], &op->result1) ||
+                    !result_ref(lx, args[1], &op->result2)) {
+                return false;
+            }
+        } else {
+            return lex_fail(lx, args[num_args - 1].start, "Expected a bound");
         }
-
-        return s;
-    } else if(d->g == CNT_RESULT) {
-        status s;
-
-        op->type = AGGREGATE;
-        op->agg = CNT;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* vec_name = strtok(NULL, close_paren);
-
-        s = prepare_result(vec_name, &(op->result1));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        if (!lex_bound(lx, args[num_args - 2], INT_MIN, &op->lower) ||
+                !lex_bound(lx, args[num_args - 1], INT_MAX, &op->upper)) {
+            return false;
         }
 
-        return s;
-    } else if (d->g == SHUTDOWN_SERVER) {
-        status s;
-
-        op->type = SHUTDOWN;
-
-        s.code = OK;
-        return s;
-    } else if (d->g == CREATE_BTREE) {
-        status s;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str));
-        strncpy(str_cpy, str, strlen(str));
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-        // This gives us everything inside the parens
-        strtok(var_name, open_paren);
-        char* args = strtok(NULL, close_paren);
-        strtok(args, comma);
-        char* arg = strtok(NULL, comma);
-
-        char col_name[strlen(arg)];
-        strcpy(col_name, arg);
-
-        int tbl_idx = find_table_from_col_name(arg);
-        if (tbl_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find table\n";
-            log_err(s.error_message);
-            return s;
-        }
-        table* table1 = global_db->tables[tbl_idx];
-
-        int col_idx = find_column(table1, col_name);
-        if (col_idx == -1) {
-            s.code = ERROR;
-            s.error_message = "Cannot find column\n";
-            log_err(s.error_message);
-            return s;
-        }
-        column* col1 = table1->col[col_idx];
-        // Check if index exists for this column
-        if (col1->index) {
-            s.code = ERROR;
-            s.error_message = "Index already exists for this column\n";
-            log_err(s.error_message);
-            return s;
-        }
-
-        s = create_index(col1, B_PLUS_TREE);
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        op->type = SELECT;
+        return true;
+    } else if (g == PROJECT_COLUMN) {
+        // fetch(<col_name>,<pos_var>)
+        token col_name, pos_name;
+        int tbl_idx, col_idx;
+        if (!lex_word(lx, &col_name, "Expected a column name") ||
+                !column_ref(lx, col_name, &tbl_idx, &col_idx) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &pos_name, "Expected a variable") ||
+                !result_ref(lx, pos_name, &op->result1) || !lex_expect(lx, ')')) {
+            return false;
         }
 
-        op->type = CREATE_OP;
-        s.code = OK;
-        return s;
-
-    } else if (d->g == ADD_RESULT) {
-        status s;
-
-        op->type = ADD;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* args = strtok(NULL, close_paren);
-        char* vec_name = strtok(args, comma);
-        char var_name1[strlen(vec_name)];
-        strcpy(var_name1, vec_name);
+        op->type = PROJECT;
+        op->columns = global_db->tables[tbl_idx]->col + col_idx;
+        return true;
+    } else if (g == TUPLE_RESULT) {
+        // tuple(<vec1>,...,<vecN>)
+        tuples* tups = lex_alloc(lx, sizeof(struct tuples));
+        void** payloads = lex_alloc(lx, DEFAULT_NUM_COLS * sizeof(void*));
+        DataType* types = lex_alloc(lx, DEFAULT_NUM_COLS * sizeof(DataType));
+        if (!tups || !payloads || !types) {
+            return lex_fail(lx, lx->pos, "Query too long");
+        }
+        tups->payloads = payloads;
+        tups->types = types;
+        tups->num_cols = 0;
+        tups->num_rows = 0;
+        tups->from_columns = false;
+
+        while (1) {
+            token vec_name;
+            if (!lex_word(lx, &vec_name, "Expected a variable")) {
+                return false;
+            }
+            if (tups->num_cols == DEFAULT_NUM_COLS) {
+                return lex_fail(lx, vec_name.start, "Too many columns in tuple");
+            }
 
-        vec_name = strtok(NULL, comma);
-        char var_name2[strlen(vec_name)];
-        strcpy(var_name2, vec_name);
+            // Variables and whole columns are sent as they are, but for
+            // select bitmaps, which go out as positions
+            result* res = find_result(vec_name.start, vec_name.len);
+            column* col = res ? NULL : find_vector_column(vec_name);
+            if (res && materialize_positions(res).code != OK) {
+                return lex_fail(lx, vec_name.start, "Cannot allocate positions");
+            }
+            if (res) {
+                tups->payloads[tups->num_cols] = res->payload;
+                tups->num_rows = res->num_tuples;
+                tups->types[tups->num_cols] = res->type;
+            } else if (col) {
+                tups->payloads[tups->num_cols] = col->data;
+                tups->num_rows = col->data_count;
+                tups->types[tups->num_cols] = INT;
+                tups->from_columns = true;
+            } else {
+                return lex_fail(lx, vec_name.start, "Cannot find var");
+            }
+            tups->num_cols++;
 
-        s = prepare_result(var_name1, &(op->result1));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+            if (*lx->pos != ',') {
+                break;
+            }
+            lx->pos++;
         }
-
-        s = prepare_result(var_name2, &(op->result2));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        if (!lex_expect(lx, ')')) {
+            return false;
         }
 
-        if (op->result1->num_tuples != op->result2->num_tuples) {
-            s.code = ERROR;
-            s.error_message = "Vectors must have same length\n";
-            log_err(s.error_message);
-            return s;
+        op->type = TUPLE;
+        op->tups = tups;
+        return true;
+    } else if (g == AVG_RESULT || g == MAX_RESULT || g == MIN_RESULT || g == CNT_RESULT) {
+        // avg(<vec>), max(<vec>), min(<vec>) and count(<vec>)
+        token vec_name;
+        if (!lex_word(lx, &vec_name, "Expected a variable") ||
+                !vector_ref(lx, vec_name, &op->result1) || !lex_expect(lx, ')')) {
+            return false;
         }
 
-        s.code = OK;
-        return s;
-    } else if (d->g == SUB_RESULT) {
-        status s;
-
-        op->type = SUB;
-
-        // Create a working copy, +1 for '\0'
-        char* str_cpy = malloc(strlen(str) + 1);
-        strncpy(str_cpy, str, strlen(str) + 1);
-        char* var_name = strtok(str_cpy, "=");
-        op->name1 = malloc(strlen(var_name)+1);
-        strcpy(op->name1, var_name);
-
-        // This gives us everything inside the parens
-        strtok(NULL, open_paren);
-        char* args = strtok(NULL, close_paren);
-        char* vec_name = strtok(args, comma);
-        char var_name1[strlen(vec_name)];
-        strcpy(var_name1, vec_name);
-
-        vec_name = strtok(NULL, comma);
-        char var_name2[strlen(vec_name)];
-        strcpy(var_name2, vec_name);
-
-        s = prepare_result(var_name1, &(op->result1));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        op->type = AGGREGATE;
+        if (g == AVG_RESULT) {
+            op->agg = AVG;
+        } else if (g == MAX_RESULT) {
+            op->agg = MAX;
+        } else if (g == MIN_RESULT) {
+            op->agg = MIN;
+        } else {
+            op->agg = CNT;
+        }
+        return true;
+    } else if (g == ADD_RESULT || g == SUB_RESULT) {
+        // add(<vec1>,<vec2>) and sub(<vec1>,<vec2>)
+        token vec_name1, vec_name2;
+        if (!lex_word(lx, &vec_name1, "Expected a variable") ||
+                !vector_ref(lx, vec_name1, &op->result1) || !lex_expect(lx, ',') ||
+                !lex_word(lx, &vec_name2, "Expected a variable") ||
+                !vector_ref(lx, vec_name2, &op->result2) || !lex_expect(lx, ')')) {
+            return false;
         }
-
-        s = prepare_result(var_name2, &(op->result2));
-        if (s.code != OK) {
-            log_err(s.error_message);
-            return s;
+        if (op->result1->num_tuples != op->result2->num_tuples) {
+            return lex_fail(lx, vec_name2.start, "Vectors must have same length");
+        }
+
+        op->type = g == ADD_RESULT ? ADD : SUB;
+        return true;
+    } else if (g == HASH_JOIN || g == PLANNED_JOIN) {
+        // join(<val1>,<pos1>,<val2>,<pos2>)
+        token vec_names[4];
+        result** inputs[4] = { &(op->result1), &(op->result2), &(op->result3), &(op->result4) };
+        for(int i = 0; i < 4; i++) {
+            if ((i > 0 && !lex_expect(lx, ',')) ||
+                    !lex_word(lx, &vec_names[i], "Expected a variable") ||
+                    !vector_ref(lx, vec_names[i], inputs[i])) {
+                return false;
+            }
+        }
+        if (!lex_expect(lx, ')')) {
+            return false;
         }
-
         if (op->result1->num_tuples != op->result2->num_tuples) {
-            s.code = ERROR;
-            s.error_message = "Vectors must have same length\n";
-            log_err(s.error_message);
-            return s;
+            return lex_fail(lx, vec_names[1].start, "Vectors must have same length");
+        }
+        if (op->result3->num_tuples != op->result4->num_tuples) {
+            return lex_fail(lx, vec_names[3].start, "Vectors must have same length");
         }
 
-        s.code = OK;
-        return s;
+        op->type = JOIN;
+        op->join = g == HASH_JOIN ? JOIN_HASH : JOIN_AUTO;
+        return true;
+    } else if (g == SHUTDOWN_SERVER) {
+        op->type = SHUTDOWN;
+        return true;
+    } else if (g == BATCH_QUERIES) {
+        // Selects are queued per column until batch_execute()
+        op->type = BATCH;
+        return lex_expect(lx, ')');
+    } else if (g == BATCH_EXECUTE) {
+        op->type = SHARED_SCAN;
+        return lex_expect(lx, ')');
+    } else if (g == BULK_LOAD) {
+        // load("<file_path>"), a path the server reads the rows from
+        token path;
+        if (!lex_expect(lx, '"')) {
+            return false;
+        }
+        path.start = lx->pos;
+        while (*lx->pos && *lx->pos != '"' && !isspace((unsigned char) *lx->pos)) {
+            lx->pos++;
+        }
+        path.len = lx->pos - path.start;
+        if (path.len == 0) {
+            return lex_fail(lx, path.start, "Expected a file path");
+        }
+        if (!lex_expect(lx, '"') || !lex_expect(lx, ')')) {
+            return false;
+        }
+
+        op->type = LOAD_FILE;
+        op->name1 = lex_name(lx, NULL, path);
+        return op->name1 != NULL;
     }
 
-    // Should have been caught earlier...
-    status fail;
-    fail.code = ERROR;
-    return fail;
+    return lex_fail(lx, lx->str, "Unsupported command");
 }
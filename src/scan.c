@@ -0,0 +1,255 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+select_kernel chosen_kernel = select_range_scalar;
+bitmap_kernel chosen_bitmap_kernel = select_bitmap_scalar;
+const char* chosen_kernel_name = "scalar";
+pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+size_t select_range_scalar(const int* data, const int* pos, size_t n,
+        int lower, int upper, size_t base, int* out) {
+    size_t j = 0;
+    if (pos) {
+        for(size_t i = 0; i < n; i++) {
+            int qualifies = lower <= data[i] && data[i] < upper;
+            out[j] = pos[i];
+            j += qualifies;
+        }
+    } else {
+        for(size_t i = 0; i < n; i++) {
+            int qualifies = lower <= data[i] && data[i] < upper;
+            out[j] = (int) (base + i);
+            j += qualifies;
+        }
+    }
+    return j;
+}
+
+size_t select_bitmap_scalar(const int* data, size_t n, int lower, int upper,
+        uint64_t* bits) {
+    size_t count = 0;
+    for(size_t w = 0; w * 64 < n; w++) {
+        const int* vals = data + w * 64;
+        size_t num_vals = n - w * 64 < 64 ? n - w * 64 : 64;
+        uint64_t word = 0;
+        for(size_t b = 0; b < num_vals; b++) {
+            word |= (uint64_t) (lower <= vals[b] && vals[b] < upper) << b;
+        }
+        bits[w] = word;
+        count += __builtin_popcountll(word);
+    }
+    return count;
+}
+
+#ifdef SCAN_X86
+
+// compact_perm[mask] moves the lanes set in @mask to the front, in order
+int compact_perm[256][8] __attribute__((aligned(32)));
+
+/*
+* Every 8 values, out gets the qualifying ones at the front of a full
+* vector store. out + j never passes data + i, so the store stays within the
+* n values out has room for.
+*/
+__attribute__((target("avx2,popcnt")))
+size_t select_range_avx2(const int* data, const int* pos, size_t n,
+        int lower, int upper, size_t base, int* out) {
+    const __m256i vlower = _mm256_set1_epi32(lower);
+    const __m256i vupper = _mm256_set1_epi32(upper);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i idx = _mm256_add_epi32(_mm256_set1_epi32((int) base),
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+    size_t i = 0;
+    size_t j = 0;
+    for(; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (data + i));
+        __m256i qualifies = _mm256_andnot_si256(_mm256_cmpgt_epi32(vlower, v),
+            _mm256_cmpgt_epi32(vupper, v));
+        unsigned mask = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(qualifies));
+
+        __m256i vals = pos ? _mm256_loadu_si256((const __m256i*) (pos + i)) : idx;
+        __m256i perm = _mm256_load_si256((const __m256i*) compact_perm[mask]);
+        _mm256_storeu_si256((__m256i*) (out + j), _mm256_permutevar8x32_epi32(vals, perm));
+        j += __builtin_popcount(mask);
+        idx = _mm256_add_epi32(idx, step);
+    }
+
+    return j + select_range_scalar(data + i, pos ? pos + i : NULL, n - i,
+        lower, upper, base + i, out + j);
+}
+
+// As select_range_avx2, 16 values at a time, compacted by vpcompressd
+__attribute__((target("avx512f,popcnt")))
+size_t select_range_avx512(const int* data, const int* pos, size_t n,
+        int lower, int upper, size_t base, int* out) {
+    const __m512i vlower = _mm512_set1_epi32(lower);
+    const __m512i vupper = _mm512_set1_epi32(upper);
+    const __m512i step = _mm512_set1_epi32(16);
+    __m512i idx = _mm512_add_epi32(_mm512_set1_epi32((int) base),
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+    size_t i = 0;
+    size_t j = 0;
+    for(; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512(data + i);
+        __mmask16 mask = _mm512_mask_cmplt_epi32_mask(
+            _mm512_cmpge_epi32_mask(v, vlower), v, vupper);
+
+        __m512i vals = pos ? _mm512_loadu_si512(pos + i) : idx;
+        _mm512_storeu_si512(out + j, _mm512_maskz_compress_epi32(mask, vals));
+        j += __builtin_popcount(mask);
+        idx = _mm512_add_epi32(idx, step);
+    }
+
+    return j + select_range_scalar(data + i, pos ? pos + i : NULL, n - i,
+        lower, upper, base + i, out + j);
+}
+
+// Each word's bits are the movemasks of eight 8-value compares
+__attribute__((target("avx2,popcnt")))
+size_t select_bitmap_avx2(const int* data, size_t n, int lower, int upper,
+        uint64_t* bits) {
+    const __m256i vlower = _mm256_set1_epi32(lower);
+    const __m256i vupper = _mm256_set1_epi32(upper);
+
+    size_t w = 0;
+    size_t count = 0;
+    for(; (w + 1) * 64 <= n; w++) {
+        uint64_t word = 0;
+        for(int k = 0; k < 8; k++) {
+            __m256i v = _mm256_loadu_si256((const __m256i*) (data + w * 64 + k * 8));
+            __m256i qualifies = _mm256_andnot_si256(_mm256_cmpgt_epi32(vlower, v),
+                _mm256_cmpgt_epi32(vupper, v));
+            word |= (uint64_t) (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(qualifies)) << (k * 8);
+        }
+        bits[w] = word;
+        count += __builtin_popcountll(word);
+    }
+
+    return count + select_bitmap_scalar(data + w * 64, n - w * 64, lower, upper, bits + w);
+}
+
+// Each word's bits are the masks of four 16-value compares
+__attribute__((target("avx512f,popcnt")))
+size_t select_bitmap_avx512(const int* data, size_t n, int lower, int upper,
+        uint64_t* bits) {
+    const __m512i vlower = _mm512_set1_epi32(lower);
+    const __m512i vupper = _mm512_set1_epi32(upper);
+
+    size_t w = 0;
+    size_t count = 0;
+    for(; (w + 1) * 64 <= n; w++) {
+        uint64_t word = 0;
+        for(int k = 0; k < 4; k++) {
+            __m512i v = _mm512_loadu_si512(data + w * 64 + k * 16);
+            __mmask16 mask = _mm512_mask_cmplt_epi32_mask(
+                _mm512_cmpge_epi32_mask(v, vlower), v, vupper);
+            word |= (uint64_t) mask << (k * 16);
+        }
+        bits[w] = word;
+        count += __builtin_popcountll(word);
+    }
+
+    return count + select_bitmap_scalar(data + w * 64, n - w * 64, lower, upper, bits + w);
+}
+
+#endif // SCAN_X86
+
+void choose_kernel() {
+#ifdef SCAN_X86
+    for(unsigned mask = 0; mask < 256; mask++) {
+        int k = 0;
+        for(int lane = 0; lane < 8; lane++) {
+            if (mask & (1u << lane)) {
+                compact_perm[mask][k++] = lane;
+            }
+        }
+        while (k < 8) {
+            compact_perm[mask][k++] = 0;
+        }
+    }
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        chosen_kernel = select_range_avx512;
+        chosen_bitmap_kernel = select_bitmap_avx512;
+        chosen_kernel_name = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        chosen_kernel = select_range_avx2;
+        chosen_bitmap_kernel = select_bitmap_avx2;
+        chosen_kernel_name = "avx2";
+    }
+#endif
+}
+
+size_t select_range(const int* data, const int* pos, size_t n,
+        int lower, int upper, size_t base, int* out) {
+    pthread_once(&kernel_once, choose_kernel);
+    return chosen_kernel(data, pos, n, lower, upper, base, out);
+}
+
+size_t select_bitmap(const int* data, size_t n, int lower, int upper, uint64_t* bits) {
+    pthread_once(&kernel_once, choose_kernel);
+    return chosen_bitmap_kernel(data, n, lower, upper, bits);
+}
+
+int select_prefers_bitmap(const int* data, size_t n, int lower, int upper) {
+    if (n < SELECT_SAMPLE_SIZE) {
+        return 0;
+    }
+
+    // Evenly spaced, so runs of similar values are not sampled as a whole
+    size_t stride = n / SELECT_SAMPLE_SIZE;
+    size_t hits = 0;
+    for(size_t i = 0; i < SELECT_SAMPLE_SIZE; i++) {
+        int val = data[i * stride];
+        hits += lower <= val && val < upper;
+    }
+    return hits * BITMAP_SELECTIVITY > SELECT_SAMPLE_SIZE;
+}
+
+const char* select_kernel_name() {
+    pthread_once(&kernel_once, choose_kernel);
+    return chosen_kernel_name;
+}
+
+select_kernel find_select_kernel(const char* name) {
+    pthread_once(&kernel_once, choose_kernel);
+    if (strcmp(name, "scalar") == 0) {
+        return select_range_scalar;
+    }
+#ifdef SCAN_X86
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return select_range_avx2;
+    }
+    if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+        return select_range_avx512;
+    }
+#endif
+    return NULL;
+}
+
+bitmap_kernel find_bitmap_kernel(const char* name) {
+    pthread_once(&kernel_once, choose_kernel);
+    if (strcmp(name, "scalar") == 0) {
+        return select_bitmap_scalar;
+    }
+#ifdef SCAN_X86
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return select_bitmap_avx2;
+    }
+    if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+        return select_bitmap_avx512;
+    }
+#endif
+    return NULL;
+}
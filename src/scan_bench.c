@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+/**
+ * scan_bench.c
+ *
+ * Times the select kernels against the scalar loop selects used before
+ * them, which called check_data for every value, over a column of random
+ * values at several selectivities. Every kernel's output is checked
+ * against that loop. The bitmap kernels ("+bits") are timed the same way,
+ * with the size of their output against a position list's.
+ *
+ * Usage: ./scan_bench [num_values]
+ **/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scan.h"
+
+#define BENCH_DEFAULT_VALUES (16 * 1024 * 1024)
+#define BENCH_VALUE_RANGE 1000000
+#define BENCH_RUNS 5
+
+// As in helpers.c, which the select loop could not inline it from
+__attribute__((noinline))
+int bench_check_data(int data, int lower, int upper) {
+    return (int)(lower <= data && data < upper);
+}
+
+size_t select_range_loop(const int* data, const int* pos, size_t n,
+        int lower, int upper, size_t base, int* out) {
+    size_t j = 0;
+    for(size_t i = 0; i < n; i++) {
+        int qualifies = bench_check_data(data[i], lower, upper);
+        out[j] = (pos ? pos[i] : (int) (base + i))*qualifies;
+        j += qualifies;
+    }
+    return j;
+}
+
+// Whether @bits holds exactly the @count positions in @expected
+int same_bits(const uint64_t* bits, size_t n, const int* expected, size_t count) {
+    size_t j = 0;
+    for(size_t i = 0; i < n; i++) {
+        if ((bits[i / 64] >> (i % 64)) & 1) {
+            if (j == count || expected[j] != (int) i) {
+                return 0;
+            }
+            j++;
+        }
+    }
+    return j == count;
+}
+
+double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_VALUES;
+    int* data = malloc(n * sizeof(int));
+    int* expected = malloc(n * sizeof(int));
+    int* out = malloc(n * sizeof(int));
+    uint64_t* bits = malloc((n + 63) / 64 * sizeof(uint64_t));
+    if (!data || !expected || !out || !bits) {
+        fprintf(stderr, "Cannot allocate %zu values\n", n);
+        return 1;
+    }
+
+    srand(165);
+    for(size_t i = 0; i < n; i++) {
+        data[i] = rand() % BENCH_VALUE_RANGE;
+    }
+
+    const char* names[] = { "loop", "scalar", "avx2", "avx512" };
+    size_t num_kernels = sizeof(names) / sizeof(names[0]);
+    double selectivities[] = { 0.001, 0.01, 0.1, 0.5, 0.9 };
+
+    printf("%zu values, select_range runs %s\n", n, select_kernel_name());
+    printf("%-12s %-12s %10s %10s %12s\n", "selectivity", "kernel", "ms", "speedup", "output MB");
+
+    for(size_t s = 0; s < sizeof(selectivities) / sizeof(selectivities[0]); s++) {
+        int upper = (int) (selectivities[s] * BENCH_VALUE_RANGE);
+        size_t expected_count = select_range_loop(data, NULL, n, 0, upper, 0, expected);
+        double loop_ms = 0;
+
+        for(size_t k = 0; k < num_kernels; k++) {
+            select_kernel kernel = k == 0 ? select_range_loop : find_select_kernel(names[k]);
+            if (!kernel) {
+                printf("%-12g %-12s %10s\n", selectivities[s], names[k], "n/a");
+                continue;
+            }
+
+            double best = 0;
+            size_t count = 0;
+            for(int run = 0; run < BENCH_RUNS; run++) {
+                double start = now_ms();
+                count = kernel(data, NULL, n, 0, upper, 0, out);
+                double elapsed = now_ms() - start;
+                best = run == 0 || elapsed < best ? elapsed : best;
+            }
+            if (k == 0) {
+                loop_ms = best;
+            }
+
+            int same = count == expected_count &&
+                memcmp(out, expected, count * sizeof(int)) == 0;
+            printf("%-12g %-12s %10.2f %9.2fx %12.2f%s\n", selectivities[s], names[k], best,
+                loop_ms / best, count * sizeof(int) / 1e6, same ? "" : "  WRONG RESULT");
+        }
+
+        for(size_t k = 1; k < num_kernels; k++) {
+            bitmap_kernel kernel = find_bitmap_kernel(names[k]);
+            if (!kernel) {
+                continue;
+            }
+
+            double best = 0;
+            size_t count = 0;
+            for(int run = 0; run < BENCH_RUNS; run++) {
+                double start = now_ms();
+                count = kernel(data, n, 0, upper, bits);
+                double elapsed = now_ms() - start;
+                best = run == 0 || elapsed < best ? elapsed : best;
+            }
+
+            char name[16];
+            snprintf(name, sizeof(name), "%s+bits", names[k]);
+            int same = count == expected_count && same_bits(bits, n, expected, count);
+            printf("%-12g %-12s %10.2f %9.2fx %12.2f%s\n", selectivities[s], name, best,
+                loop_ms / best, (n + 63) / 64 * sizeof(uint64_t) / 1e6,
+                same ? "" : "  WRONG RESULT");
+        }
+    }
+
+    free(data);
+    free(expected);
+    free(out);
+    free(bits);
+    return 0;
+}
@@ -24,6 +24,12 @@
 #include <unistd.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 
 #include "common.h"
 #include "cs165_api.h"
@@ -31,10 +37,22 @@
 #include "parser.h"
 #include "utils.h"
 #include "helpers.h"
+#include "join.h"
+#include "wal.h"
+#include "load.h"
 
 #define DEFAULT_QUERY_BUFFER_SIZE 1024
 #define change 10
 
+// Bytes read from a socket at a time, and at most per turn of the event
+// loop so one busy client cannot starve the others.
+#define CONNECTION_READ_SIZE 65536
+#define CONNECTION_READ_BUDGET (16 * CONNECTION_READ_SIZE)
+#define MAX_EPOLL_EVENTS 64
+
+// Rows of a tuple() result sent per frame
+#define TUPLE_BATCH_ROWS 8192
+
 // Here, we allow for a global of DSL COMMANDS to be shared in the program
 dsl** dsl_commands;
 
@@ -44,24 +62,303 @@ db* global_db;
 // Variable pool for clients
 catalog** catalogs;
 
+// One session per connected client, each with its own catalog slot
+session* sessions[DEFAULT_NUM_CLIENTS_ALLOWED];
+pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+__thread session* current_session;
+
+// Queries that change the db take db_lock exclusively; all others share it
+// and run in parallel.
+pthread_rwlock_t db_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+int server_socket;
+bool shutting_down = false;
+
+/**
+ * io_buffer
+ * A growable byte buffer.
+ **/
+typedef struct io_buffer {
+    char* data;
+    size_t len;
+    size_t capacity;
+} io_buffer;
+
+/**
+ * connection
+ * A client socket served by the event loop. Incoming bytes are buffered in
+ * @in until a whole request has arrived: @query holds its text, and for a
+ * load @rows holds the rows sent so far. The response, tagged with the
+ * @request_id of the request, is staged in @out until the socket takes it.
+ * A streamed response is instead described by @iov, runs of @out and of
+ * result payloads that are sent in place. While a worker runs the request
+ * it owns the connection and its session, and the loop leaves both alone.
+ **/
+typedef struct connection {
+    int fd;
+    session* sess;
+    io_buffer in;
+    size_t in_off;
+    io_buffer out;
+    size_t out_sent;
+    struct iovec* iov;
+    size_t iov_count;
+    size_t iov_capacity;
+    size_t iov_sent;
+    message_status kind;
+    size_t request_id;
+    char* query;
+    bool loading;
+    io_buffer rows;
+    bool closing;
+    struct connection* next;
+} connection;
+
+// The event loop watches every socket; workers take requests off the job
+// queue and hand their connections back through the done list, waking the
+// loop with done_fd.
+int epoll_fd;
+int done_fd;
+connection* jobs_head;
+connection* jobs_tail;
+pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobs_ready = PTHREAD_COND_INITIALIZER;
+connection* done_head;
+pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * add_to_catalog(name, r)
+ * Stores the intermediate result @r under the variable @name in the
+ * current client's catalog. A result that cannot be stored is freed.
+ **/
+void add_to_catalog(const char* name, result* r) {
+    status s = bind_result(name, r);
+    if (s.code != OK) {
+        log_err(s.error_message);
+        free_result(r);
+    }
+}
+
+/**
+ * run_shared_scan(q)
+ * Answers all selects queued on one column in a single pass and publishes
+ * their results. The queue is left empty.
+ **/
+status run_shared_scan(select_queue* q) {
+    status s = shared_scan(q);
+    for(size_t i = 0; i < q->buffer_count; i++) {
+        thread_args* args = q->buffer[i];
+        if (s.code == OK) {
+            add_to_catalog(args->query->name1, args->res);
+        } else {
+            free_result(args->res);
+        }
+        free(args->query->name1);
+        free(args->query);
+        free(args);
+    }
+    q->buffer_count = 0;
+    return s;
+}
+
+/**
+ * queue_select(query)
+ * Queues a select on its column's shared scan. A queue that reaches
+ * DEFAULT_SHARED_SCAN_BUFFER_SIZE selects is executed right away.
+ **/
+status queue_select(db_operator* query) {
+    status s;
+    column* col = *(query->columns);
+
+    select_queue** shared_scans = current_session->shared_scans;
+    size_t shared_scan_count = current_session->shared_scan_count;
+
+    select_queue* q = NULL;
+    for(size_t i = 0; i < shared_scan_count; i++) {
+        if (shared_scans[i]->col == col) {
+            q = shared_scans[i];
+            break;
+        }
+    }
+
+    if (!q) {
+        if (shared_scan_count == DEFAULT_NUM_COLS) {
+            s.code = ERROR;
+            s.error_message = "Too many columns in batch\n";
+            return s;
+        }
+        q = malloc(sizeof(struct select_queue));
+        q->buffer = calloc(DEFAULT_SHARED_SCAN_BUFFER_SIZE, sizeof(struct thread_args*));
+        q->buffer_count = 0;
+        q->col = col;
+        shared_scans[shared_scan_count] = q;
+        current_session->shared_scan_count++;
+    }
+
+    // The query outlives its request, so it keeps a copy of what it needs
+    thread_args* args = malloc(sizeof(struct thread_args));
+    args->query = malloc(sizeof(struct db_operator));
+    *args->query = *query;
+    args->query->name1 = strdup(query->name1);
+    args->res = init_result();
+    args->start = 0;
+    args->end = col->data_count;
+    q->buffer[q->buffer_count] = args;
+    q->buffer_count++;
+
+    if (q->buffer_count == DEFAULT_SHARED_SCAN_BUFFER_SIZE) {
+        return run_shared_scan(q);
+    }
+
+    s.code = OK;
+    return s;
+}
+
+/**
+ * open_session()
+ * Claims a free catalog slot for a new client, or returns NULL if
+ * DEFAULT_NUM_CLIENTS_ALLOWED clients are already connected.
+ **/
+session* open_session() {
+    session* sess = NULL;
+
+    pthread_mutex_lock(&sessions_lock);
+    for(int i = 0; i < DEFAULT_NUM_CLIENTS_ALLOWED; i++) {
+        if (!sessions[i]) {
+            sess = calloc(1, sizeof(struct session));
+            if (sess) {
+                sess->vars = catalogs[i];
+                sess->slot = i;
+                sessions[i] = sess;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sessions_lock);
+
+    return sess;
+}
+
+/**
+ * close_session(sess)
+ * Drops the client's variables and queued selects and frees its slot.
+ **/
+void close_session(session* sess) {
+    for(size_t i = 0; i < sess->shared_scan_count; i++) {
+        select_queue* q = sess->shared_scans[i];
+        for(size_t j = 0; j < q->buffer_count; j++) {
+            free_result(q->buffer[j]->res);
+            free(q->buffer[j]->query->name1);
+            free(q->buffer[j]->query);
+            free(q->buffer[j]);
+        }
+        free(q->buffer);
+        free(q);
+    }
+    clear_catalog(sess->vars);
+
+    pthread_mutex_lock(&sessions_lock);
+    sessions[sess->slot] = NULL;
+    pthread_mutex_unlock(&sessions_lock);
+    free(sess);
+}
+
+/**
+ * is_write_command(str)
+ * Whether the DSL command @str changes the db, and so must run alone.
+ **/
+bool is_write_command(const char* str) {
+    return strncmp(str, "create(", 7) == 0 ||
+        strncmp(str, "relational_", 11) == 0 ||
+        strncmp(str, "load(", 5) == 0 ||
+        strncmp(str, "shutdown", 8) == 0;
+}
+
 /**
  * parse_command takes as input the send_message from the client and then
- * parses it into the appropriate query. Stores into send_message the
- * status to send back.
- * Returns a db_operator.
+ * parses it into the query @dbo, using @mem for anything the query needs
+ * to point to. Stores into send_message the status to send back.
+ * Returns the status of the parse.
  **/
-db_operator* parse_command(message* recv_message, message* send_message, status* parse_status) {
+status parse_command(message* recv_message, message* send_message, db_operator* dbo,
+        parse_scratch* mem) {
     send_message->status = OK_WAIT_FOR_RESPONSE;
-    // check load flags here
-    db_operator *dbo = init_dbo();
+    memset(dbo, 0, sizeof(struct db_operator));
     // Here you parse the message and fill in the proper db_operator fields for
     // now we just log the payload
     cs165_log(stdout, recv_message->payload);
 
-    // Here, we give you a default parser, you are welcome to replace it with anything you want
-    *parse_status = parse_command_string(recv_message->payload, dsl_commands, dbo);
+    return parse_command_string(recv_message->payload, dsl_commands, dbo, mem);
+}
+
+/**
+ * create_object(query)
+ * Creates the db, table, column or index described by the CREATE_OP
+ * @query.
+ **/
+status create_object(db_operator* query) {
+    status s;
+
+    if (query->object == DB_OBJECT) {
+        log_info("create_db(%s)\n", query->name1);
+        if (global_db) {
+            s.code = ERROR;
+            s.error_message = "DB already exists\n";
+            return s;
+        }
+        return create_db(query->name1, &global_db);
+    } else if (query->object == TABLE_OBJECT) {
+        log_info("create_table(%s, %zu)\n", query->name1, query->num_cols);
+        if (find_table(query->name1, strlen(query->name1)) != -1) {
+            s.code = ERROR;
+            s.error_message = "Table name already exists\n";
+            return s;
+        }
+        table* tbl1 = NULL;
+        return create_table(global_db, query->name1, query->num_cols, &tbl1);
+    } else if (query->object == COLUMN_OBJECT) {
+        log_info("create_column(%s, %d)\n", query->name1, query->sorted);
+        table* tbl1 = query->tables[0];
+        if (find_column(tbl1, query->name1, strlen(query->name1)) != -1) {
+            s.code = ERROR;
+            s.error_message = "Column name already exists\n";
+            return s;
+        }
+        column* col1 = NULL;
+        return create_column(tbl1, query->name1, &col1, query->sorted);
+    }
 
-    return dbo;
+    column* col1 = *(query->columns);
+    if (col1->index) {
+        s.code = ERROR;
+        s.error_message = "Index already exists for this column\n";
+        return s;
+    }
+    return create_index(col1, query->index_type);
+}
+
+/**
+ * materialize_inputs(query)
+ * Turns the select bitmaps @query reads into position lists, except for
+ * the first input of fetches, vector selects and aggregates, which read
+ * bitmaps as they are.
+ **/
+status materialize_inputs(db_operator* query) {
+    status s;
+    result* inputs[] = { query->result1, query->result2, query->result3, query->result4 };
+    bool reads_bitmap = query->type == PROJECT || query->type == SELECT ||
+        query->type == AGGREGATE;
+
+    s.code = OK;
+    for(size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        if (inputs[i] && !(i == 0 && reads_bitmap)) {
+            s = materialize_positions(inputs[i]);
+            if (s.code != OK) {
+                return s;
+            }
+        }
+    }
+    return s;
 }
 
 /** execute_db_operator takes as input the db_operator and executes the query.
@@ -72,17 +369,66 @@ db_operator* parse_command(message* recv_message, message* send_message, status*
 char* execute_db_operator(db_operator* query) {
     status s;
 
-    if (query->type == INSERT) {
+    s = materialize_inputs(query);
+    if (s.code != OK) {
+        return s.error_message;
+    }
+
+    if (query->type == CREATE_OP) {
+        s = create_object(query);
+        if (s.code != OK) {
+            log_err(s.error_message);
+            return s.error_message;
+        }
+    } else if (query->type == BATCH) {
+        // Selects are queued per column until batch_execute()
+        current_session->batching = true;
+    } else if (query->type == INSERT) {
         table* tbl1 = query->tables[0];
-        for(size_t i = 0; i < tbl1->col_count; i++) {
-            s = col_insert(query->columns[i], query->value1[i]);
+        s = insert_row(tbl1, query->value1);
+        if (s.code != OK) {
+            return s.error_message;
+        }
+        s = wal_log_insert(query->tables - global_db->tables, query->value1, tbl1->col_count);
+        if (s.code != OK) {
+            return s.error_message;
+        }
+        return "Rows successfully inserted.";
+    } else if (query->type == UPDATE) {
+        table* tbl1 = query->tables[0];
+        result* pos = query->result1;
+        s = update(*(query->columns), (int*)pos->payload, pos->num_tuples, query->value1[0]);
+        if (s.code != OK) {
+            return s.error_message;
+        }
+        s = wal_log_update(query->tables - global_db->tables, query->columns - tbl1->col,
+            (int*)pos->payload, pos->num_tuples, query->value1[0]);
+        if (s.code != OK) {
+            return s.error_message;
+        }
+        return "Rows successfully updated.";
+    } else if (query->type == DELETE) {
+        result* pos = query->result1;
+        s = delete(query->tables[0], (int*)pos->payload, pos->num_tuples);
+        if (s.code != OK) {
+            return s.error_message;
+        }
+        s = wal_log_delete(query->tables - global_db->tables, (int*)pos->payload, pos->num_tuples);
+        if (s.code != OK) {
+            return s.error_message;
+        }
+        return "Rows successfully deleted.";
+    } else if (query->type == SELECT) {
+        if (current_session->batching && query->columns &&
+                !(*query->columns)->leading && !(*query->columns)->index) {
+            s = queue_select(query);
             if (s.code != OK) {
                 return s.error_message;
             }
+            return "Query batched";
         }
-        return "Rows successfully inserted.";
-    } else if (query->type == SELECT) {
-        result* r = malloc(sizeof(struct result));
+
+        result* r = init_result();
         if (query->columns) {
             s = select_data(query, &r);
         } else if (query->result1 && query->result2) {
@@ -94,46 +440,32 @@ char* execute_db_operator(db_operator* query) {
         if (s.code != OK) {
             return s.error_message;
         }
-        int idx = catalogs[0]->var_count;
-        catalogs[0]->names[idx] = query->name1;
-        catalogs[0]->results[idx] = r;
-        catalogs[0]->var_count++;
+        add_to_catalog(query->name1, r);
     } else if (query->type == PROJECT) {
-        result* r = malloc(sizeof(struct result));
-        status s = fetch(*(query->columns), query->result1->payload, query->result1->num_tuples, &r);
+        result* r = init_result();
+        result* pos = query->result1;
+        status s = pos->type == BITMAP ? fetch_bitmap(*(query->columns), pos, &r) :
+            fetch(*(query->columns), pos->payload, pos->num_tuples, &r);
         if (s.code != OK) {
             return s.error_message;
         }
-        int idx = catalogs[0]->var_count;
-        catalogs[0]->names[idx] = query->name1;
-        catalogs[0]->results[idx] = r;
-        catalogs[0]->var_count++;
+        add_to_catalog(query->name1, r);
     } else if (query->type == ADD) {
-        result* r = malloc(sizeof(struct result));
+        result* r = init_result();
         s = add_col((int*)query->result1->payload, (int*)query->result2->payload, query->result1->num_tuples, &r);
         if (s.code != OK) {
             return s.error_message;
         }
-        int idx = catalogs[0]->var_count;
-        catalogs[0]->names[idx] = query->name1;
-        catalogs[0]->results[idx] = r;
-        // for (size_t i = 0; i < r->num_tuples; ++i)
-        // {
-        //     printf("%ld\n", ((long*)r->payload)[i]);
-        // }
-        catalogs[0]->var_count++;
+        add_to_catalog(query->name1, r);
     } else if (query->type == SUB) {
-        result* r = malloc(sizeof(struct result));
+        result* r = init_result();
         s = sub_col((int*)query->result1->payload, (int*)query->result2->payload, query->result1->num_tuples, &r);
         if (s.code != OK) {
             return s.error_message;
         }
-        int idx = catalogs[0]->var_count;
-        catalogs[0]->names[idx] = query->name1;
-        catalogs[0]->results[idx] = r;
-        catalogs[0]->var_count++;
+        add_to_catalog(query->name1, r);
     } else if (query->type == AGGREGATE) {
-        result* r = malloc(sizeof(struct result));
+        result* r = init_result();
         if (query->agg == MIN) {
             s = min_col(query->result1, &r);
         } else if (query->agg == MAX) {
@@ -150,197 +482,656 @@ char* execute_db_operator(db_operator* query) {
             return s.error_message;
         }
 
-        int idx = catalogs[0]->var_count;
-        catalogs[0]->names[idx] = query->name1;
-        catalogs[0]->results[idx] = r;
-        catalogs[0]->var_count++;
+        add_to_catalog(query->name1, r);
+    } else if (query->type == JOIN) {
+        result* r1 = init_result();
+        result* r2 = init_result();
+        if (query->join == JOIN_HASH) {
+            s = hash_join(query->result1, query->result2, query->result3, query->result4, &r1, &r2);
+        } else {
+            s = join_data(query->result1, query->result2, query->result3, query->result4, &r1, &r2);
+        }
+        if (s.code != OK) {
+            free(r1);
+            free(r2);
+            return s.error_message;
+        }
+        add_to_catalog(query->name1, r1);
+        add_to_catalog(query->name2, r2);
+    } else if (query->type == SHARED_SCAN) {
+        if (!current_session->batching) {
+            return "No batch in progress\n";
+        }
+
+        s.code = OK;
+        for(size_t i = 0; i < current_session->shared_scan_count; i++) {
+            select_queue* q = current_session->shared_scans[i];
+            status qs = run_shared_scan(q);
+            if (qs.code != OK) {
+                s = qs;
+            }
+            free(q->buffer);
+            free(q);
+        }
+        current_session->shared_scan_count = 0;
+        current_session->batching = false;
+
+        if (s.code != OK) {
+            return s.error_message;
+        }
     }
 
     return "Success";
 }
 
 /**
- * handle_client(client_socket)
- * This is the execution routine after a client has connected.
- * It will continually listen for messages from the client and execute queries.
+ * buffer_reserve(b, extra)
+ * Makes room for @extra more bytes in @b. Returns false if out of memory.
+ **/
+bool buffer_reserve(io_buffer* b, size_t extra) {
+    if (b->len + extra <= b->capacity) {
+        return true;
+    }
+    size_t capacity = b->capacity ? b->capacity : CONNECTION_READ_SIZE;
+    while (capacity < b->len + extra) {
+        capacity *= 2;
+    }
+    char* data = realloc(b->data, capacity);
+    if (!data) {
+        return false;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return true;
+}
+
+/**
+ * buffer_append(b, bytes, n)
+ * Appends @n bytes to @b. Returns false if out of memory.
+ **/
+bool buffer_append(io_buffer* b, const void* bytes, size_t n) {
+    if (!buffer_reserve(b, n)) {
+        return false;
+    }
+    memcpy(b->data + b->len, bytes, n);
+    b->len += n;
+    return true;
+}
+
+/**
+ * reply(conn, send_message, payload, length)
+ * Stages a response for @conn; the event loop writes it out once the
+ * worker hands the connection back.
+ **/
+void reply(connection* conn, message* send_message, const void* payload, size_t length) {
+    wire_header wire;
+    message_to_wire(send_message, &wire);
+    if (!buffer_append(&conn->out, &wire, sizeof(wire_header)) ||
+            !buffer_append(&conn->out, payload, length)) {
+        log_err("Failed to stage response.\n");
+        conn->closing = true;
+    }
+}
+
+/**
+ * stream(conn, bytes, n, copy)
+ * Queues @n bytes of a streamed response. With @copy they are staged in
+ * conn->out, which must already have room for them so that nothing
+ * queued before moves; otherwise they are sent from where they are.
+ **/
+bool stream(connection* conn, const void* bytes, size_t n, bool copy) {
+    if (n == 0) {
+        return true;
+    }
+    if (conn->iov_count == conn->iov_capacity) {
+        size_t capacity = conn->iov_capacity ? 2 * conn->iov_capacity : 64;
+        struct iovec* iov = realloc(conn->iov, capacity * sizeof(struct iovec));
+        if (!iov) {
+            return false;
+        }
+        conn->iov = iov;
+        conn->iov_capacity = capacity;
+    }
+
+    if (copy) {
+        if (conn->out.capacity - conn->out.len < n) {
+            return false;
+        }
+        char* staged = conn->out.data + conn->out.len;
+        memcpy(staged, bytes, n);
+        conn->out.len += n;
+        bytes = staged;
+    }
+    conn->iov[conn->iov_count].iov_base = (void*) bytes;
+    conn->iov[conn->iov_count].iov_len = n;
+    conn->iov_count++;
+    return true;
+}
+
+/**
+ * reply_str(conn, send_message, str)
+ * Stages the string response @str for @conn.
+ **/
+void reply_str(connection* conn, message* send_message, const char* str) {
+    send_message->type = CHAR;
+    send_message->length = strlen(str);
+    reply(conn, send_message, str, send_message->length);
+}
+
+/**
+ * serve_load(conn)
+ * Bulk loads the row batches buffered for @conn into the table named by
+ * the load's header line, all under one exclusive hold of the db.
  **/
-void handle_client(int client_socket) {
-    int done = 0;
-    int length = 0;
+void serve_load(connection* conn) {
+    message send_message;
+    memset(&send_message, 0, sizeof(message));
+    send_message.request_id = conn->request_id;
+    send_message.status = OK_WAIT_FOR_RESPONSE;
+
+    // The client gave up on a row it could not parse
+    if (conn->kind == INCORRECT_FORMAT) {
+        reply_str(conn, &send_message, "Malformed row in load file\n");
+        return;
+    }
+
+    // Loads change the db, so they hold it exclusively throughout
+    pthread_rwlock_wrlock(&db_lock);
+
+    // Loaded rows skip the log; the load ends in a checkpoint
+    status s = load_batches(conn->query, conn->rows.data, conn->rows.len);
+    if (s.code == OK) {
+        s = persist_data();
+    }
+    pthread_rwlock_unlock(&db_lock);
 
-    log_info("Connected to socket: %d.\n", client_socket);
+    reply_str(conn, &send_message, s.code == OK ? "Bulk load done" : s.error_message);
+}
 
-    // Create two messages, one from which to read and one from which to receive
+/**
+ * serve_query(conn)
+ * Parses and executes the query buffered for @conn and stages its
+ * response.
+ **/
+void serve_query(connection* conn) {
     message send_message;
     message recv_message;
+    memset(&send_message, 0, sizeof(message));
+    send_message.request_id = conn->request_id;
+    recv_message.payload = conn->query;
 
-    // Continually receive messages from client and execute queries.
-    // 1. Parse the command
-    // 2. Handle request if appropriate
-    // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
-    // 4. Send response of request.
-    do {
-        length = recv(client_socket, &recv_message, sizeof(message), 0);
-        if (length < 0) {
-            log_err("Client connection closed!\n");
-            exit(1);
-        } else if (length == 0) {
-            done = 1;
+    // The query and everything it points to live on this stack
+    db_operator dbo;
+    db_operator* query = &dbo;
+    parse_scratch scratch;
+
+    bool writes = is_write_command(recv_message.payload);
+    if (writes) {
+        pthread_rwlock_wrlock(&db_lock);
+    } else {
+        pthread_rwlock_rdlock(&db_lock);
+    }
+
+    // 1. Parse command
+    status parse_status = parse_command(&recv_message, &send_message, query, &scratch);
+
+    // 2. Handle request
+    if (parse_status.code != OK) {
+        // Something went wrong
+        pthread_rwlock_unlock(&db_lock);
+        reply_str(conn, &send_message, parse_status.error_message);
+
+    } else if (query->type == TUPLE) {
+        tuples* tups = query->tups;
+        size_t widths[DEFAULT_NUM_COLS];
+        uint32_t types[DEFAULT_NUM_COLS];
+        size_t row_width = 0;
+        for(size_t j = 0; j < tups->num_cols; j++) {
+            widths[j] = type_width(tups->types[j]);
+            types[j] = tups->types[j];
+            row_width += widths[j];
         }
 
-        if (recv_message.status == LOAD_REQUEST) {
-            char recv_buffer[recv_message.length];
-            length = recv(client_socket, recv_buffer, recv_message.length,0);
-            recv_message.payload = recv_buffer;
-            recv_message.payload[recv_message.length] = '\0';
+        // The client's own results stay put until its next query, so
+        // they are sent in place; columns are copied while db_lock still
+        // keeps other clients from changing them.
+        bool copy = tups->from_columns;
+        size_t num_batches = (tups->num_rows + TUPLE_BATCH_ROWS - 1) / TUPLE_BATCH_ROWS;
+        size_t staged = (num_batches + 1) * sizeof(wire_header) +
+            tups->num_cols * sizeof(uint32_t) +
+            (copy ? tups->num_rows * row_width : 0);
+
+        // 3. Send the shape of the whole result with the type of each
+        // column, then frames of rows with one column at a time
+        send_message.type = tups->types[0];
+        send_message.num_rows = tups->num_rows;
+        send_message.num_cols = tups->num_cols;
+        send_message.length = (int) (tups->num_cols * sizeof(uint32_t));
+        wire_header wire;
+        message_to_wire(&send_message, &wire);
+        bool staging = buffer_reserve(&conn->out, staged) &&
+            stream(conn, &wire, sizeof(wire_header), true) &&
+            stream(conn, types, tups->num_cols * sizeof(uint32_t), true);
 
-            char* col_name = strtok(recv_buffer, ",");
-            int tbl_idx = find_table_from_col_name(col_name);
-            if (tbl_idx == -1) {
-                log_err("Cannot find table.\n");
-                exit(1);
+        for(size_t row = 0; row < tups->num_rows && staging; row += TUPLE_BATCH_ROWS) {
+            size_t batch_rows = tups->num_rows - row;
+            batch_rows = batch_rows < TUPLE_BATCH_ROWS ? batch_rows : TUPLE_BATCH_ROWS;
+            send_message.num_rows = batch_rows;
+            send_message.length = (int) (batch_rows * row_width);
+            message_to_wire(&send_message, &wire);
+            staging = stream(conn, &wire, sizeof(wire_header), true);
+            for(size_t j = 0; j < tups->num_cols && staging; j++) {
+                staging = stream(conn, (char*) tups->payloads[j] + row * widths[j],
+                    batch_rows * widths[j], copy);
             }
-            table* tbl = global_db->tables[tbl_idx];
-
-            while((length = recv(client_socket, &recv_message, sizeof(message), 0)) > 0) {
-                if (recv_message.status == OK_WAIT_FOR_RESPONSE &&
-                        (int) recv_message.length > 0) {
-                    // Calculate number of bytes in response package
-                    size_t num_bytes = recv_message.length;
-                    char payload[num_bytes + 1];
-
-                    if ((length = recv(client_socket, payload, num_bytes, 0)) > 0) {
-                        db_operator* dbo = init_dbo();
-                        status s = relational_insert(tbl_idx, payload, dbo);
-                        if (s.code != OK) {
-                            log_err(s.error_message);
-                            exit(1);
-                        }
-                        char* result = execute_db_operator(dbo);
-                        log_info("%s\n", result);
-                    }
-                } else if (recv_message.status == LOAD_DONE) {
-                    status s = process_indexes(tbl);
-                    char* result = "Bulk load done";
-                    if (s.code != OK) {
-                        result = s.error_message;
-                    }
-
-                    send_message.status = OK_WAIT_FOR_RESPONSE;
-                    send_message.type = CHAR;
-                    send_message.length = strlen(result);
-
-                    // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
-                    if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                        log_err("Failed to send message.");
-                        exit(1);
-                    }
-
-                    // 4. Send response of request
-                    if (send(client_socket, result, send_message.length, 0) == -1) {
-                        log_err("Failed to send message.");
-                        exit(1);
-                    }
-
-                    break;
-                }
+        }
+        pthread_rwlock_unlock(&db_lock);
+
+        if (!staging) {
+            log_err("Failed to stage response.\n");
+            conn->closing = true;
+        }
+
+    } else if (query->type == LOAD_FILE) {
+        // Loaded rows skip the log; the load ends in a checkpoint
+        bool readable;
+        status s = load_file(query->name1, &readable);
+        if (s.code == OK) {
+            s = persist_data();
+        }
+        pthread_rwlock_unlock(&db_lock);
+
+        if (!readable) {
+            // The file is not visible here; have the client send the rows
+            send_message.status = LOAD_FROM_CLIENT;
+            reply(conn, &send_message, NULL, 0);
+        } else {
+            reply_str(conn, &send_message, s.code == OK ? "Bulk load done" : s.error_message);
+        }
+
+    } else if (query->type == SHUTDOWN) {
+        status s = persist_data();
+        if (s.code != OK) {
+            log_err("Error persisting data\n");
+        }
+
+        // free what you can
+        free_db();
+
+        send_message.status = SHUTDOWN_CLIENT;
+        reply(conn, &send_message, NULL, 0);
+
+        // Keep db_lock so no other query touches the freed db; the event
+        // loop exits once this reply is out.
+        shutting_down = true;
+        conn->closing = true;
+
+    } else {
+        char* result = execute_db_operator(query);
+
+        // Schema changes are not logged; checkpoint so later log
+        // records always find their tables and columns on recovery.
+        status s;
+        s.code = OK;
+        if (writes && query->type == CREATE_OP) {
+            s = persist_data();
+        }
+        pthread_rwlock_unlock(&db_lock);
+
+        // Changes are durable before they are acknowledged
+        if (writes && s.code == OK) {
+            s = wal_commit();
+        }
+        if (s.code == OK && wal_needs_checkpoint()) {
+            pthread_rwlock_wrlock(&db_lock);
+            if (wal_needs_checkpoint()) {
+                s = persist_data();
             }
-            continue;
+            pthread_rwlock_unlock(&db_lock);
+        }
+        if (s.code != OK) {
+            result = s.error_message;
         }
 
-        if (!done) {
-            char recv_buffer[recv_message.length];
-            length = recv(client_socket, recv_buffer, recv_message.length,0);
-            recv_message.payload = recv_buffer;
-            recv_message.payload[recv_message.length] = '\0';
-
-            // 1. Parse command
-            status parse_status;
-            db_operator* query = parse_command(&recv_message, &send_message, &parse_status);
-
-            // 2. Handle request
-            char* result = NULL;
-            if (parse_status.code != OK) {
-                // Something went wrong
-                result = parse_status.error_message;
-                send_message.type = CHAR;
-                send_message.length = strlen(result);
-                
-            } else if (query->type == TUPLE) {
-                send_message.type = query->tups->type;
-                send_message.num_rows = query->tups->num_rows;
-                send_message.num_cols = query->tups->num_cols;
-                send_message.length = (int) (send_message.num_rows * send_message.num_cols);
-
-                if (send_message.type == INT) {
-                    send_message.length *= sizeof(int);
-                } else if (send_message.type == LONG) {
-                    send_message.length *= sizeof(long);
-                } else if (send_message.type == LONG_DOUBLE) {
-                    send_message.length *= sizeof(long double);
-                } else {
-                    send_message.length *= sizeof(char);
-                }
+        // 3. Send status of the received message and the response
+        reply_str(conn, &send_message, result);
+    }
+}
 
-                // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
-                if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                    log_err("Failed to send message.");
-                    exit(1);
-                }
+/**
+ * worker_thread(arg)
+ * Takes requests off the job queue one at a time, runs them as their
+ * client's session and hands the connection back to the event loop.
+ **/
+void* worker_thread(void* arg) {
+    (void) arg;
+    while (1) {
+        pthread_mutex_lock(&jobs_lock);
+        while (!jobs_head) {
+            pthread_cond_wait(&jobs_ready, &jobs_lock);
+        }
+        connection* conn = jobs_head;
+        jobs_head = conn->next;
+        if (!jobs_head) {
+            jobs_tail = NULL;
+        }
+        pthread_mutex_unlock(&jobs_lock);
 
-                // 4. Send response of request
-                for(size_t i = 0; i < send_message.num_cols; i++) {
-                    char* result = (char*)query->tups->payloads[i];
-                    int length = send_message.length/(int)send_message.num_cols;
-                    if (send(client_socket, result, length, 0) == -1) {
-                        log_err("Failed to send message.");
-                        exit(1);
-                    }
-                }
+        current_session = conn->sess;
+        if (conn->kind != OK_WAIT_FOR_RESPONSE) {
+            serve_load(conn);
+        } else {
+            serve_query(conn);
+        }
+        current_session = NULL;
 
-                continue;
+        pthread_mutex_lock(&done_lock);
+        conn->next = done_head;
+        done_head = conn;
+        pthread_mutex_unlock(&done_lock);
 
-            } else if (query->type == SHUTDOWN) {
-                status s = persist_data();
-                if (s.code != OK) {
-                    log_err("Error persisting data\n");
-                }
+        uint64_t one = 1;
+        if (write(done_fd, &one, sizeof(one)) < 0) {
+            log_err("Failed to wake the event loop.\n");
+        }
+    }
+    return NULL;
+}
 
-                // free what you can
-                // s = free_catalogs();
-                if (s.code != OK) {
-                    log_err("Error shutting down\n");
-                }
+/**
+ * dispatch(conn)
+ * Queues the complete request buffered on @conn for the worker pool. The
+ * connection is left unarmed until the worker is done with it, so each
+ * client's requests run and are answered in the order they were sent.
+ **/
+void dispatch(connection* conn) {
+    conn->next = NULL;
 
-                send_message.status = SHUTDOWN_CLIENT;
-                if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                    log_err("Failed to send message.");
-                    close(client_socket);
-                }
+    pthread_mutex_lock(&jobs_lock);
+    if (jobs_tail) {
+        jobs_tail->next = conn;
+    } else {
+        jobs_head = conn;
+    }
+    jobs_tail = conn;
+    pthread_cond_signal(&jobs_ready);
+    pthread_mutex_unlock(&jobs_lock);
+}
 
-                return;
-            } else {
-                result = execute_db_operator(query);
-                send_message.type = CHAR;
-                send_message.length = strlen(result);
+/**
+ * next_request(conn)
+ * Consumes whole frames from @conn's input until a request is complete.
+ * Row batches of a load are moved to conn->rows as they arrive, so the
+ * request is only complete at LOAD_DONE.
+ * Returns 1 when a request is ready in conn->query, 0 if more bytes are
+ * needed and -1 on a malformed frame.
+ **/
+int next_request(connection* conn) {
+    while (1) {
+        size_t avail = conn->in.len - conn->in_off;
+        if (avail < sizeof(wire_header)) {
+            return 0;
+        }
+
+        wire_header wire;
+        message header;
+        memcpy(&wire, conn->in.data + conn->in_off, sizeof(wire_header));
+        if (wire_to_message(&wire, &header) == -1) {
+            return -1;
+        }
+
+        // LOAD_DONE carries no payload, nor does the INCORRECT_FORMAT a
+        // client ends a load with when it cannot parse a row
+        if (conn->loading && (header.status == LOAD_DONE ||
+                header.status == INCORRECT_FORMAT)) {
+            conn->in_off += sizeof(wire_header);
+            conn->loading = false;
+            conn->kind = header.status;
+            return 1;
+        }
+
+        if (avail - sizeof(wire_header) < (size_t) header.length) {
+            return 0;
+        }
+
+        char* payload = conn->in.data + conn->in_off + sizeof(wire_header);
+        conn->in_off += sizeof(wire_header) + header.length;
+
+        if (conn->loading) {
+            // Batches are kept back to back, each after its shape
+            size_t shape[2] = { header.num_rows, header.num_cols };
+            if (header.status != LOAD_BATCH ||
+                    header.num_cols == 0 || header.num_cols > DEFAULT_NUM_COLS ||
+                    header.num_rows > (size_t) header.length ||
+                    header.num_rows * header.num_cols * sizeof(int) != (size_t) header.length ||
+                    !buffer_append(&conn->rows, shape, sizeof(shape)) ||
+                    !buffer_append(&conn->rows, payload, header.length)) {
+                return -1;
             }
+            continue;
+        }
+
+        size_t length = strnlen(payload, header.length);
+        free(conn->query);
+        conn->query = strndup(payload, length);
+        if (!conn->query) {
+            return -1;
+        }
+
+        // Requests are answered in the order they arrive
+        conn->request_id = header.request_id;
 
-            // 3. Send status of the received message (OK, UNKNOWN_QUERY, etc)
-            if (send(client_socket, &(send_message), sizeof(message), 0) == -1) {
-                log_err("Failed to send message.");
-                exit(1);
+        if (header.status == LOAD_REQUEST) {
+            conn->loading = true;
+            conn->rows.len = 0;
+            continue;
+        }
+
+        // Clients leave the status of the last load on later queries
+        conn->kind = OK_WAIT_FOR_RESPONSE;
+        return 1;
+    }
+}
+
+/**
+ * arm(conn, events)
+ * Asks the event loop to report @events on @conn once more.
+ **/
+void arm(connection* conn, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev) == -1) {
+        log_err("L%d: Failed to rearm socket %d.\n", __LINE__, conn->fd);
+    }
+}
+
+/**
+ * close_connection(conn)
+ * Closes @conn's socket and, unless the server is going down, its session.
+ **/
+void close_connection(connection* conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    log_info("Connection closed at socket %d!\n", conn->fd);
+
+    // After a shutdown the db is gone, and the process is about to exit
+    if (!shutting_down) {
+        close_session(conn->sess);
+    }
+    free(conn->in.data);
+    free(conn->out.data);
+    free(conn->iov);
+    free(conn->rows.data);
+    free(conn->query);
+    free(conn);
+}
+
+/**
+ * flush(conn)
+ * Writes as much of @conn's staged output as the socket takes.
+ * Returns false if the client is gone.
+ **/
+bool flush(connection* conn) {
+    // A streamed response covers what it staged in conn->out
+    while (conn->iov_sent < conn->iov_count) {
+        size_t count = conn->iov_count - conn->iov_sent;
+        ssize_t n = writev(conn->fd, conn->iov + conn->iov_sent, count < IOV_MAX ? count : IOV_MAX);
+        if (n > 0) {
+            // Skip the runs that went out, and trim one that partly did
+            while (conn->iov_sent < conn->iov_count &&
+                    (size_t) n >= conn->iov[conn->iov_sent].iov_len) {
+                n -= conn->iov[conn->iov_sent].iov_len;
+                conn->iov_sent++;
+            }
+            if (n > 0) {
+                conn->iov[conn->iov_sent].iov_base = (char*) conn->iov[conn->iov_sent].iov_base + n;
+                conn->iov[conn->iov_sent].iov_len -= n;
             }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            log_err("Failed to send message.\n");
+            return false;
+        }
+    }
+    if (conn->iov_count > 0) {
+        conn->iov_count = 0;
+        conn->iov_sent = 0;
+        conn->out.len = 0;
+        return true;
+    }
+
+    while (conn->out_sent < conn->out.len) {
+        ssize_t n = send(conn->fd, conn->out.data + conn->out_sent,
+            conn->out.len - conn->out_sent, 0);
+        if (n > 0) {
+            conn->out_sent += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        } else {
+            log_err("Failed to send message.\n");
+            return false;
+        }
+    }
+    conn->out.len = 0;
+    conn->out_sent = 0;
+    return true;
+}
+
+/**
+ * service_connection(conn)
+ * Runs on the event loop whenever @conn is idle and ready: writes out any
+ * pending response, then reads until a whole request is buffered and
+ * hands it to the workers. Returns false once the shutdown reply is out.
+ **/
+bool service_connection(connection* conn) {
+    if (!flush(conn)) {
+        close_connection(conn);
+        return true;
+    }
+    if (conn->out.len > 0 || conn->iov_count > 0) {
+        arm(conn, EPOLLOUT);
+        return true;
+    }
+    if (conn->closing) {
+        bool stop = shutting_down;
+        close_connection(conn);
+        return !stop;
+    }
+
+    // Drop consumed frames before reading more
+    if (conn->in_off > 0) {
+        memmove(conn->in.data, conn->in.data + conn->in_off, conn->in.len - conn->in_off);
+        conn->in.len -= conn->in_off;
+        conn->in_off = 0;
+    }
+
+    size_t budget = CONNECTION_READ_BUDGET;
+    while (1) {
+        int ready = next_request(conn);
+        if (ready < 0) {
+            log_err("Malformed message on socket %d.\n", conn->fd);
+            close_connection(conn);
+            return true;
+        } else if (ready > 0) {
+            dispatch(conn);
+            return true;
+        }
+
+        // Let other clients in; the socket is still readable, so the loop
+        // comes straight back here.
+        if (budget == 0) {
+            break;
+        }
+
+        if (!buffer_reserve(&conn->in, CONNECTION_READ_SIZE)) {
+            log_err("Failed to buffer message.\n");
+            close_connection(conn);
+            return true;
+        }
+        ssize_t n = recv(conn->fd, conn->in.data + conn->in.len, CONNECTION_READ_SIZE, 0);
+        if (n > 0) {
+            conn->in.len += n;
+            budget -= (size_t) n < budget ? (size_t) n : budget;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            // Hung up, possibly mid-request
+            close_connection(conn);
+            return true;
+        }
+    }
+
+    arm(conn, EPOLLIN);
+    return true;
+}
 
-            // 4. Send response of request
-            if (send(client_socket, result, send_message.length, 0) == -1) {
-                log_err("Failed to send message.");
-                exit(1);
+/**
+ * accept_clients()
+ * Accepts every pending connection, each with a session of its own.
+ **/
+void accept_clients() {
+    while (1) {
+        int client_socket = accept4(server_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_socket == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_err("L%d: Failed to accept a new connection.\n", __LINE__);
             }
+            return;
         }
-    } while (!done);
 
-    log_info("Connection closed at socket %d!\n", client_socket);
-    close(client_socket);
+        connection* conn = calloc(1, sizeof(struct connection));
+        if (conn) {
+            conn->sess = open_session();
+        }
+        if (!conn || !conn->sess) {
+            log_err("Too many clients connected.\n");
+            free(conn);
+            close(client_socket);
+            continue;
+        }
+        conn->fd = client_socket;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = conn;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &ev) == -1) {
+            log_err("L%d: Failed to watch socket %d.\n", __LINE__, client_socket);
+            close_connection(conn);
+            continue;
+        }
+        log_info("Connected to socket: %d.\n", client_socket);
+    }
 }
 
 /**
@@ -356,7 +1147,7 @@ int setup_server() {
 
     log_info("Attempting to setup server...\n");
 
-    if ((server_socket = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+    if ((server_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) {
         log_err("L%d: Failed to create socket.\n", __LINE__);
         return -1;
     }
@@ -379,17 +1170,19 @@ int setup_server() {
     return server_socket;
 }
 
-// Currently this main will setup the socket and accept a single client.
-// After handling the client, it will exit.
-// You will need to extend this to handle multiple concurrent clients
-// and remain running until it receives a shut-down command.
+// This main will setup the socket and serve any number of concurrent
+// clients from one event loop, running their queries on a pool of worker
+// threads, until one of them sends shutdown.
 int main()
 {
-    int server_socket = setup_server();
+    server_socket = setup_server();
     if (server_socket < 0) {
         exit(1);
     }
 
+    // A client hanging up mid-reply must not take the server down
+    signal(SIGPIPE, SIG_IGN);
+
     status s = grab_persisted_data();
     if (s.code != OK) {
         log_err(s.error_message);
@@ -400,18 +1193,72 @@ int main()
     dsl_commands = dsl_commands_init();
     catalogs = init_catalogs();
 
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd == -1 || done_fd == -1) {
+        log_err("L%d: Failed to set up the event loop.\n", __LINE__);
+        exit(1);
+    }
+
+    // The listening socket and the workers' wakeups are told apart from
+    // connections by their tags
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &server_socket;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_socket, &ev);
+    ev.data.ptr = &done_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, done_fd, &ev);
+
+    for(int i = 0; i < DEFAULT_NUM_WORKERS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_thread, NULL) != 0) {
+            log_err("L%d: Failed to start a worker thread.\n", __LINE__);
+            exit(1);
+        }
+        pthread_detach(thread);
+    }
+
     log_info("Waiting for a connection %d ...\n", server_socket);
 
-    struct sockaddr_un remote;
-    socklen_t t = sizeof(remote);
-    int client_socket = 0;
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    bool running = true;
+    while (running) {
+        int n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_err("L%d: Failed to wait for events.\n", __LINE__);
+            exit(1);
+        }
+
+        for(int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &server_socket) {
+                if (!shutting_down) {
+                    accept_clients();
+                }
+            } else if (events[i].data.ptr == &done_fd) {
+                uint64_t count;
+                if (read(done_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    log_err("L%d: Failed to read worker wakeup.\n", __LINE__);
+                }
 
-    if ((client_socket = accept(server_socket, (struct sockaddr *)&remote, &t)) == -1) {
-        log_err("L%d: Failed to accept a new connection.\n", __LINE__);
-        exit(1);
+                pthread_mutex_lock(&done_lock);
+                connection* conn = done_head;
+                done_head = NULL;
+                pthread_mutex_unlock(&done_lock);
+
+                while (conn) {
+                    connection* next = conn->next;
+                    running = service_connection(conn) && running;
+                    conn = next;
+                }
+            } else {
+                running = service_connection(events[i].data.ptr) && running;
+            }
+        }
     }
-    handle_client(client_socket);
 
+    close(server_socket);
     return 0;
 }
-
@@ -0,0 +1,76 @@
+#include <limits.h>
+#include <string.h>
+#include "sorted.h"
+#include "utils.h"
+
+void free_sorted_index(sorted_index* idx) {
+    if (!idx) {
+        return;
+    }
+    free(idx->vals);
+    free(idx->positions);
+    free(idx);
+}
+
+status build_sorted_index(column* col) {
+    status s;
+
+    free_sorted_index((sorted_index*)col->index->index);
+    col->index->index = NULL;
+
+    sorted_index* idx = calloc(1, sizeof(struct sorted_index));
+    size_t n = col->data_count;
+    kv_pair* pairs = sort_pairs(col->data, NULL, n);
+    if (!idx || !pairs) {
+        free(idx);
+        free(pairs);
+        s.code = ERROR;
+        s.error_message = "Error sorting column for index\n";
+        return s;
+    }
+
+    idx->count = n;
+    idx->vals = malloc((n ? n : 1) * sizeof(int));
+    idx->positions = malloc((n ? n : 1) * sizeof(int));
+    if (!idx->vals || !idx->positions) {
+        free_sorted_index(idx);
+        free(pairs);
+        s.code = ERROR;
+        s.error_message = "Error allocating sorted index\n";
+        return s;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        idx->vals[i] = pairs[i].key;
+        idx->positions[i] = pairs[i].pos;
+    }
+    free(pairs);
+
+    col->index->index = idx;
+    s.code = OK;
+    return s;
+}
+
+status find_range_sorted(column* col, result* r, int lower, int upper) {
+    log_info("Searching in sorted index\n");
+    status s;
+
+    sorted_index* idx = (sorted_index*)col->index->index;
+    r->type = INT;
+    r->num_tuples = 0;
+    if (lower >= upper) {
+        s.code = OK;
+        return s;
+    }
+
+    // binary_search finds the first value > target, so searching for
+    // bound - 1 gives the first value >= bound.
+    size_t start = lower == INT_MIN ? 0 : binary_search(idx->vals, lower - 1, 0, idx->count);
+    size_t end = binary_search(idx->vals, upper - 1, start, idx->count);
+
+    memcpy(r->payload, idx->positions + start, (end - start) * sizeof(int));
+    r->num_tuples = end - start;
+
+    s.code = OK;
+    return s;
+}
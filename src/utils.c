@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "utils.h"
 
@@ -46,3 +49,85 @@ void log_info(const char *format, ...) {
 }
 
 
+
+ssize_t read_fully(int fd, void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char*)buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+ssize_t write_fully(int fd, const void* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, (const char*)buf + done, len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+void message_to_wire(const message* m, wire_header* wire) {
+    wire->status = m->status;
+    wire->type = m->type;
+    wire->request_id = m->request_id;
+    wire->length = m->length < 0 ? 0 : (uint64_t) m->length;
+    wire->num_rows = m->num_rows;
+    wire->num_cols = m->num_cols;
+}
+
+int wire_to_message(const wire_header* wire, message* m) {
+    if (wire->length > INT_MAX) {
+        return -1;
+    }
+    m->status = (message_status) wire->status;
+    m->type = (DataType) wire->type;
+    m->request_id = wire->request_id;
+    m->length = (int) wire->length;
+    m->payload = NULL;
+    m->num_rows = wire->num_rows;
+    m->num_cols = wire->num_cols;
+    return 0;
+}
+
+int send_frame(int fd, const message* header, const void* payload) {
+    wire_header wire;
+    message_to_wire(header, &wire);
+    if (write_fully(fd, &wire, sizeof(wire)) == -1 ||
+            write_fully(fd, payload, wire.length) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int recv_header(int fd, message* header) {
+    wire_header wire;
+    if (read_fully(fd, &wire, sizeof(wire)) == -1) {
+        return -1;
+    }
+    return wire_to_message(&wire, header);
+}
+
+size_t type_width(DataType type) {
+    if (type == INT) {
+        return sizeof(int);
+    } else if (type == LONG) {
+        return sizeof(long);
+    } else if (type == LONG_DOUBLE) {
+        return sizeof(long double);
+    }
+    return sizeof(char);
+}
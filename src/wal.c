@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "wal.h"
+#include "utils.h"
+
+extern db* global_db;
+
+int wal_fd = -1;
+uint64_t wal_lsn = 0;
+size_t wal_size = 0;            // bytes in the log file, buffered included
+
+char* wal_buffer = NULL;
+size_t wal_buffer_count = 0;
+
+// Group commit: one committing client at a time syncs everything appended
+// so far, and clients whose records that sync covered just wait for it.
+pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t wal_synced = PTHREAD_COND_INITIALIZER;
+uint64_t wal_synced_lsn = 0;
+bool wal_syncing = false;
+
+void wal_path(char* path, size_t len) {
+    snprintf(path, len, "%s/%s", DATA_DIR, WAL_FILE);
+}
+
+uint32_t wal_checksum(wal_record* rec, int* vals) {
+    // FNV-1a over the header fields and the values
+    uint32_t h = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)rec;
+    for (size_t i = 0; i < offsetof(wal_record, checksum); i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    bytes = (const unsigned char*)vals;
+    for (size_t i = 0; i < rec->num_vals * sizeof(int); i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+status wal_flush() {
+    status s;
+
+    if (wal_buffer_count > 0) {
+        if (write_fully(wal_fd, wal_buffer, wal_buffer_count) == -1) {
+            s.code = ERROR;
+            s.error_message = "Error writing log\n";
+            return s;
+        }
+        wal_buffer_count = 0;
+    }
+
+    s.code = OK;
+    return s;
+}
+
+status wal_append_locked(OperatorType type, size_t tbl_idx, size_t col_idx,
+        int* first, int* vals, size_t num_vals) {
+    status s;
+
+    if (wal_fd == -1) {
+        s.code = ERROR;
+        s.error_message = "Log is not open\n";
+        return s;
+    }
+
+    // An UPDATE carries its new value ahead of the positions
+    size_t total_vals = num_vals + (first ? 1 : 0);
+    size_t len = sizeof(wal_record) + total_vals * sizeof(int);
+    if (wal_buffer_count + len > WAL_BUFFER_SIZE) {
+        s = wal_flush();
+        if (s.code != OK) {
+            return s;
+        }
+    }
+
+    char* rec_buf = wal_buffer + wal_buffer_count;
+    bool spill = len > WAL_BUFFER_SIZE;
+    if (spill) {
+        rec_buf = malloc(len);
+        if (!rec_buf) {
+            s.code = ERROR;
+            s.error_message = "Error allocating log record\n";
+            return s;
+        }
+    }
+
+    wal_record* rec = (wal_record*)rec_buf;
+    int* rec_vals = (int*)(rec + 1);
+    if (first) {
+        rec_vals[0] = *first;
+    }
+    memcpy(rec_vals + (first ? 1 : 0), vals, num_vals * sizeof(int));
+
+    rec->lsn = wal_lsn + 1;
+    rec->type = type;
+    rec->table = tbl_idx;
+    rec->column = col_idx;
+    rec->num_vals = total_vals;
+    rec->pad = 0;
+    rec->checksum = wal_checksum(rec, rec_vals);
+
+    if (spill) {
+        ssize_t written = write_fully(wal_fd, rec_buf, len);
+        free(rec_buf);
+        if (written == -1) {
+            s.code = ERROR;
+            s.error_message = "Error writing log\n";
+            return s;
+        }
+    } else {
+        wal_buffer_count += len;
+    }
+
+    wal_lsn++;
+    wal_size += len;
+
+    s.code = OK;
+    return s;
+}
+
+status wal_append(OperatorType type, size_t tbl_idx, size_t col_idx,
+        int* first, int* vals, size_t num_vals) {
+    pthread_mutex_lock(&wal_lock);
+    status s = wal_append_locked(type, tbl_idx, col_idx, first, vals, num_vals);
+    pthread_mutex_unlock(&wal_lock);
+    return s;
+}
+
+status wal_log_insert(size_t tbl_idx, int* vals, size_t num_vals) {
+    return wal_append(INSERT, tbl_idx, 0, NULL, vals, num_vals);
+}
+
+status wal_log_update(size_t tbl_idx, size_t col_idx, int* pos, size_t num_pos, int new_val) {
+    return wal_append(UPDATE, tbl_idx, col_idx, &new_val, pos, num_pos);
+}
+
+status wal_log_delete(size_t tbl_idx, int* pos, size_t num_pos) {
+    return wal_append(DELETE, tbl_idx, 0, NULL, pos, num_pos);
+}
+
+status wal_commit() {
+    status s;
+    s.code = OK;
+
+    pthread_mutex_lock(&wal_lock);
+    uint64_t target = wal_lsn;
+    while (s.code == OK && wal_synced_lsn < target) {
+        if (wal_syncing) {
+            pthread_cond_wait(&wal_synced, &wal_lock);
+            continue;
+        }
+
+        // Sync everything appended so far on behalf of every waiting client
+        s = wal_flush();
+        if (s.code != OK) {
+            break;
+        }
+        uint64_t covered = wal_lsn;
+        wal_syncing = true;
+        pthread_mutex_unlock(&wal_lock);
+
+#if WAL_SYNC
+        int ret = fdatasync(wal_fd);
+#else
+        int ret = 0;
+#endif
+
+        pthread_mutex_lock(&wal_lock);
+        wal_syncing = false;
+        if (ret == -1) {
+            s.code = ERROR;
+            s.error_message = "Error syncing log\n";
+        } else if (covered > wal_synced_lsn) {
+            wal_synced_lsn = covered;
+        }
+        pthread_cond_broadcast(&wal_synced);
+    }
+    pthread_mutex_unlock(&wal_lock);
+
+    return s;
+}
+
+bool wal_needs_checkpoint() {
+    pthread_mutex_lock(&wal_lock);
+    bool full = wal_size >= WAL_CHECKPOINT_SIZE;
+    pthread_mutex_unlock(&wal_lock);
+    return full;
+}
+
+uint64_t wal_last_lsn() {
+    pthread_mutex_lock(&wal_lock);
+    uint64_t lsn = wal_lsn;
+    pthread_mutex_unlock(&wal_lock);
+    return lsn;
+}
+
+status wal_truncate() {
+    status s;
+    s.code = OK;
+
+    pthread_mutex_lock(&wal_lock);
+    // The checkpoint holds everything logged so far, synced or not
+    wal_buffer_count = 0;
+    wal_synced_lsn = wal_lsn;
+    pthread_cond_broadcast(&wal_synced);
+    if (wal_fd != -1 && (ftruncate(wal_fd, 0) == -1 || lseek(wal_fd, 0, SEEK_SET) == -1)) {
+        s.code = ERROR;
+        s.error_message = "Error truncating log\n";
+    } else {
+        wal_size = 0;
+    }
+    pthread_mutex_unlock(&wal_lock);
+
+    return s;
+}
+
+status wal_apply(wal_record* rec, int* vals) {
+    status s;
+
+    if (!global_db || rec->table >= global_db->table_count) {
+        s.code = ERROR;
+        s.error_message = "Log record for unknown table\n";
+        return s;
+    }
+    table* tbl = global_db->tables[rec->table];
+
+    if (rec->type == INSERT) {
+        if (rec->num_vals != tbl->col_count) {
+            s.code = ERROR;
+            s.error_message = "Log record does not match table\n";
+            return s;
+        }
+        return insert_row(tbl, vals);
+    } else if (rec->type == UPDATE) {
+        if (rec->column >= tbl->col_count || rec->num_vals == 0) {
+            s.code = ERROR;
+            s.error_message = "Log record does not match table\n";
+            return s;
+        }
+        return update(tbl->col[rec->column], vals + 1, rec->num_vals - 1, vals[0]);
+    } else if (rec->type == DELETE) {
+        return delete(tbl, vals, rec->num_vals);
+    }
+
+    s.code = ERROR;
+    s.error_message = "Unknown log record\n";
+    return s;
+}
+
+status wal_recover(uint64_t checkpoint_lsn) {
+    status s;
+
+    wal_lsn = checkpoint_lsn;
+    wal_buffer = malloc(WAL_BUFFER_SIZE);
+    if (!wal_buffer) {
+        s.code = ERROR;
+        s.error_message = "Error allocating log buffer\n";
+        return s;
+    }
+
+    if (mkdir(DATA_DIR, 0755) == -1 && errno != EEXIST) {
+        s.code = ERROR;
+        s.error_message = "Error creating data directory\n";
+        return s;
+    }
+
+    char path[PATH_MAX];
+    wal_path(path, PATH_MAX);
+    wal_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (wal_fd == -1) {
+        s.code = ERROR;
+        s.error_message = "Error opening log\n";
+        return s;
+    }
+
+    // Replay up to the first torn or corrupt record, which is where a crash
+    // interrupted the last write; the rest of the log is dropped.
+    size_t valid = 0;
+    size_t replayed = 0;
+    wal_record rec;
+    int* vals = NULL;
+    size_t vals_capacity = 0;
+    while (read_fully(wal_fd, &rec, sizeof(rec)) != -1) {
+        if (rec.num_vals > vals_capacity) {
+            int* grown = realloc(vals, rec.num_vals * sizeof(int));
+            if (!grown) {
+                break;
+            }
+            vals = grown;
+            vals_capacity = rec.num_vals;
+        }
+        if (read_fully(wal_fd, vals, rec.num_vals * sizeof(int)) == -1 ||
+                rec.checksum != wal_checksum(&rec, vals)) {
+            break;
+        }
+
+        if (rec.lsn > checkpoint_lsn) {
+            s = wal_apply(&rec, vals);
+            if (s.code != OK) {
+                free(vals);
+                return s;
+            }
+            replayed++;
+        }
+        if (rec.lsn > wal_lsn) {
+            wal_lsn = rec.lsn;
+        }
+        valid += sizeof(rec) + rec.num_vals * sizeof(int);
+    }
+    free(vals);
+
+    if (ftruncate(wal_fd, valid) == -1 || lseek(wal_fd, valid, SEEK_SET) == -1) {
+        s.code = ERROR;
+        s.error_message = "Error truncating log\n";
+        return s;
+    }
+    wal_size = valid;
+    wal_synced_lsn = wal_lsn;
+    log_info("Replayed %zu log records\n", replayed);
+
+    s.code = OK;
+    return s;
+}